@@ -0,0 +1,142 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+# Benchmarks snudown on the bundled corpus, and drives the training run of
+# the profile-guided build (see `make pgo`).
+#
+# The corpus files hold documents separated by lines containing only `%%`.
+# Run against a particular build by putting it first on PYTHONPATH.
+
+from __future__ import print_function
+
+import argparse
+import io
+import json
+import os
+import sys
+import time
+
+import snudown
+
+CORPUS_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'corpus')
+SEPARATOR = u'\n%%\n'
+
+# name, renderer, keyword arguments to snudown.markdown()
+corpora = [
+    ('comments', snudown.RENDERER_USERTEXT, {}),
+    ('prose', snudown.RENDERER_USERTEXT, {}),
+    ('comments-nofollow', snudown.RENDERER_USERTEXT, {'nofollow': True, 'target': '_top'}),
+    ('wiki', snudown.RENDERER_WIKI, {'enable_toc': True}),
+    ('tables', snudown.RENDERER_USERTEXT, {}),
+    ('tables', snudown.RENDERER_WIKI, {}),
+]
+
+# corpora also timed through snudown.extract(), which only parses
+extract_corpora = ['comments', 'prose']
+
+
+def load_corpus(name):
+    path = os.path.join(CORPUS_DIR, name.split('-')[0] + '.md')
+    with io.open(path, encoding='utf-8') as f:
+        return [doc.strip(u'\n') + u'\n' for doc in f.read().split(SEPARATOR)]
+
+
+def render_all(docs, renderer, kwargs):
+    for doc in docs:
+        snudown.markdown(doc, renderer=renderer, **kwargs)
+
+
+def extract_all(docs, renderer, kwargs):
+    for doc in docs:
+        snudown.extract(doc)
+
+
+def bench_corpus(docs, renderer, kwargs, min_time, repeat, run=render_all):
+    """Returns the best throughput out of `repeat` runs, in documents and
+    bytes per second; each run renders the corpus for at least `min_time`
+    seconds."""
+    size = sum(len(doc.encode('utf-8')) for doc in docs)
+    best = None
+
+    for _ in range(repeat):
+        loops = 0
+        start = time.time()
+        while True:
+            run(docs, renderer, kwargs)
+            loops += 1
+            elapsed = time.time() - start
+            if elapsed >= min_time:
+                break
+        rate = loops / elapsed
+        if best is None or rate > best:
+            best = rate
+
+    return best * len(docs), best * size
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmarks snudown on the bundled corpus.')
+    parser.add_argument('--train', action='store_true',
+                        help='render every corpus a few times and exit, for PGO training')
+    parser.add_argument('--nul', type=int, metavar='N', default=0,
+                        help='write the corpus N times to stdout as NUL-delimited documents')
+    parser.add_argument('--min-time', type=float, default=0.5)
+    parser.add_argument('--repeat', type=int, default=5)
+    parser.add_argument('--json', metavar='FILE',
+                        help='save the results to FILE')
+    parser.add_argument('--compare', metavar='FILE',
+                        help='report the speedup over results saved with --json')
+    args = parser.parse_args()
+
+    if args.nul:
+        out = getattr(sys.stdout, 'buffer', sys.stdout)
+        for _ in range(args.nul):
+            for name, _renderer, _kwargs in corpora:
+                for doc in load_corpus(name):
+                    out.write(doc.encode('utf-8') + b'\0')
+        return
+
+    if args.train:
+        for name, renderer, kwargs in corpora:
+            docs = load_corpus(name)
+            for _ in range(200):
+                render_all(docs, renderer, kwargs)
+        return
+
+    baseline = {}
+    if args.compare:
+        with open(args.compare) as f:
+            baseline = json.load(f)
+
+    print('snudown %s (%s)' % (snudown.__version__, snudown.__file__))
+    results = {}
+    for name, renderer, kwargs in corpora:
+        label = '%s/%s' % (name, 'wiki' if renderer == snudown.RENDERER_WIKI else 'usertext')
+        docs_per_sec, bytes_per_sec = bench_corpus(
+            load_corpus(name), renderer, kwargs, args.min_time, args.repeat)
+        results[label] = bytes_per_sec
+
+        line = '%-30s %10.0f docs/s %8.2f MB/s' % (label, docs_per_sec, bytes_per_sec / 1e6)
+        if label in baseline:
+            line += '  %+6.1f%%' % ((bytes_per_sec / baseline[label] - 1) * 100)
+        print(line)
+
+    for name in extract_corpora:
+        label = '%s/extract' % name
+        docs_per_sec, bytes_per_sec = bench_corpus(
+            load_corpus(name), None, {}, args.min_time, args.repeat, run=extract_all)
+        results[label] = bytes_per_sec
+
+        line = '%-30s %10.0f docs/s %8.2f MB/s' % (label, docs_per_sec, bytes_per_sec / 1e6)
+        line += '  %5.1fx render' % (bytes_per_sec / results['%s/usertext' % name])
+        if label in baseline:
+            line += '  %+6.1f%%' % ((bytes_per_sec / baseline[label] - 1) * 100)
+        print(line)
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,676 @@
+/*
+ * Copyright (c) 2015, reddit inc.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* snudown • renders a stream of Markdown documents with the reddit
+ * renderers, for backfills and pipelines.
+ *
+ * Documents are read from a file (mapped into memory) or stdin in one of
+ * three framings, rendered in batches by a pool of threads and written to
+ * stdout in input order, in the same framing:
+ *
+ *   len	a little-endian uint32 length before each document
+ *   nul	documents terminated by a NUL byte
+ *   jsonl	one JSON string per line
+ */
+
+#include "markdown.h"
+#include "html.h"
+#include "buffer.h"
+#include "renderers.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define READ_UNIT (1024 * 1024)
+#define BATCH_DOCS 4096
+#define BATCH_BYTES (16 * 1024 * 1024)
+#define MAX_THREADS 64
+
+enum input_format {
+	FORMAT_LEN = 0,
+	FORMAT_NUL,
+	FORMAT_JSONL
+};
+
+/* worker: the renderers of one thread */
+struct worker {
+	struct module_state state;
+	struct module_state toc_state;
+	struct sd_markdown *main_renderer;
+	struct sd_markdown *toc_renderer;
+	pthread_t thread;
+	struct batch *batch;
+};
+
+/* batch: documents in flight. Document i is the slice
+ * data[offsets[i] .. offsets[i] + sizes[i]) of either the mapped input
+ * or the batch's decoded copy, and renders into outputs[i] */
+struct batch {
+	const uint8_t *data;
+	size_t *offsets;
+	size_t *sizes;
+	struct buf **outputs;
+	size_t count;
+	size_t next;	/* next document to render, shared by the workers */
+};
+
+/* command line options */
+static int renderer = RENDERER_USERTEXT;
+static enum input_format format = FORMAT_LEN;
+static int enable_toc = 0;
+static int nofollow = 0;
+static char *target = NULL;
+static char *toc_id_prefix = NULL;
+static int quiet = 0;
+
+/* init_worker • sets up the renderers of a thread; returns 0 when out
+ * of memory */
+static int
+init_worker(struct worker *worker)
+{
+	unsigned int render_flags = snudown_render_flags(renderer);
+
+	worker->main_renderer = snudown_make_renderer(&worker->state,
+		render_flags, snudown_default_md_flags, 0);
+	worker->toc_renderer = snudown_make_renderer(&worker->toc_state,
+		render_flags, snudown_default_md_flags, 1);
+
+	if (!worker->main_renderer || !worker->toc_renderer)
+		return 0;
+
+	worker->state.options.nofollow = nofollow;
+	worker->state.options.target = target;
+	worker->toc_state.options.nofollow = nofollow;
+	worker->toc_state.options.target = target;
+	return 1;
+}
+
+/* snudown_md • the same rendering as snudown.markdown() */
+static void
+snudown_md(struct worker *worker, struct buf *ob, const uint8_t *document, size_t doc_size)
+{
+	struct snudown_renderopt *options = &worker->state.options;
+	unsigned int flags = options->html.flags;
+
+	if (enable_toc) {
+		worker->toc_state.options.html.toc_id_prefix = toc_id_prefix;
+		sd_markdown_render(ob, document, doc_size, worker->toc_renderer);
+		worker->toc_state.options.html.toc_id_prefix = NULL;
+
+		options->html.flags |= HTML_TOC;
+	}
+
+	options->html.toc_id_prefix = toc_id_prefix;
+	sd_markdown_render(ob, document, doc_size, worker->main_renderer);
+
+	options->html.toc_id_prefix = NULL;
+	options->html.flags = flags;
+}
+
+static void *
+render_batch(void *arg)
+{
+	struct worker *worker = arg;
+	struct batch *batch = worker->batch;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+		bufreset(batch->outputs[i]);
+		snudown_md(worker, batch->outputs[i], batch->data + batch->offsets[i], batch->sizes[i]);
+	}
+
+	return NULL;
+}
+
+/********
+ * JSON *
+ ********/
+
+static int
+hex_value(uint8_t c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static int
+json_hex4(const uint8_t *data, size_t size, size_t i, unsigned int *value)
+{
+	size_t k;
+	int v;
+
+	if (i + 4 > size)
+		return 0;
+
+	for (*value = 0, k = 0; k < 4; ++k) {
+		if ((v = hex_value(data[i + k])) < 0)
+			return 0;
+		*value = (*value << 4) | v;
+	}
+
+	return 1;
+}
+
+static void
+put_utf8(struct buf *ob, unsigned int cp)
+{
+	if (cp < 0x80) {
+		bufputc(ob, cp);
+	} else if (cp < 0x800) {
+		bufputc(ob, 0xC0 | (cp >> 6));
+		bufputc(ob, 0x80 | (cp & 0x3F));
+	} else if (cp < 0x10000) {
+		bufputc(ob, 0xE0 | (cp >> 12));
+		bufputc(ob, 0x80 | ((cp >> 6) & 0x3F));
+		bufputc(ob, 0x80 | (cp & 0x3F));
+	} else {
+		bufputc(ob, 0xF0 | (cp >> 18));
+		bufputc(ob, 0x80 | ((cp >> 12) & 0x3F));
+		bufputc(ob, 0x80 | ((cp >> 6) & 0x3F));
+		bufputc(ob, 0x80 | (cp & 0x3F));
+	}
+}
+
+/* json_decode • decodes the JSON string on a line into ob */
+static int
+json_decode(struct buf *ob, const uint8_t *data, size_t size)
+{
+	size_t i = 0, beg;
+	unsigned int cp, low;
+
+	while (i < size && (data[i] == ' ' || data[i] == '\t' || data[i] == '\r'))
+		i++;
+
+	if (i == size || data[i] != '"')
+		return 0;
+	i++;
+
+	while (i < size) {
+		beg = i;
+		while (i < size && data[i] != '"' && data[i] != '\\')
+			i++;
+
+		bufput(ob, data + beg, i - beg);
+
+		if (i == size)
+			return 0;
+
+		if (data[i] == '"')
+			return 1;
+
+		if (++i == size)
+			return 0;
+
+		switch (data[i++]) {
+		case '"': bufputc(ob, '"'); break;
+		case '\\': bufputc(ob, '\\'); break;
+		case '/': bufputc(ob, '/'); break;
+		case 'b': bufputc(ob, '\b'); break;
+		case 'f': bufputc(ob, '\f'); break;
+		case 'n': bufputc(ob, '\n'); break;
+		case 'r': bufputc(ob, '\r'); break;
+		case 't': bufputc(ob, '\t'); break;
+		case 'u':
+			if (!json_hex4(data, size, i, &cp))
+				return 0;
+			i += 4;
+
+			/* surrogate pairs */
+			if (cp >= 0xD800 && cp <= 0xDBFF && i + 6 <= size &&
+				data[i] == '\\' && data[i + 1] == 'u' &&
+				json_hex4(data, size, i + 2, &low) && low >= 0xDC00 && low <= 0xDFFF) {
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+				i += 6;
+			} else if (cp >= 0xD800 && cp <= 0xDFFF) {
+				cp = 0xFFFD;
+			}
+
+			put_utf8(ob, cp);
+			break;
+		default:
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+static void
+json_encode(struct buf *ob, const uint8_t *data, size_t size)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i, beg;
+
+	bufputc(ob, '"');
+
+	for (i = 0; i < size; ) {
+		beg = i;
+		while (i < size && data[i] >= 0x20 && data[i] != '"' && data[i] != '\\')
+			i++;
+
+		bufput(ob, data + beg, i - beg);
+		if (i == size)
+			break;
+
+		switch (data[i]) {
+		case '"': BUFPUTSL(ob, "\\\""); break;
+		case '\\': BUFPUTSL(ob, "\\\\"); break;
+		case '\n': BUFPUTSL(ob, "\\n"); break;
+		case '\r': BUFPUTSL(ob, "\\r"); break;
+		case '\t': BUFPUTSL(ob, "\\t"); break;
+		default:
+			BUFPUTSL(ob, "\\u00");
+			bufputc(ob, hex[data[i] >> 4]);
+			bufputc(ob, hex[data[i] & 0xF]);
+			break;
+		}
+		i++;
+	}
+
+	BUFPUTSL(ob, "\"\n");
+}
+
+/*********
+ * INPUT *
+ *********/
+
+/* input: a mapped file, or stdin read into `pending` */
+struct input {
+	const uint8_t *map;
+	size_t map_size;
+	size_t pos;
+
+	int fd;
+	int eof;
+	struct buf *pending;
+};
+
+/* input_fill • makes sure `want` bytes are pending past pos when reading
+ * a stream; returns the number of bytes available */
+static size_t
+input_fill(struct input *in, size_t want)
+{
+	ssize_t n;
+
+	if (in->map)
+		return in->map_size - in->pos;
+
+	while (!in->eof && in->pending->size - in->pos < want) {
+		/* drop what was consumed before growing the buffer; documents
+		 * are copied out as soon as they are found */
+		if (in->pos > 0) {
+			memmove(in->pending->data, in->pending->data + in->pos, in->pending->size - in->pos);
+			in->pending->size -= in->pos;
+			in->pos = 0;
+		}
+
+		bufgrow(in->pending, in->pending->size + READ_UNIT);
+		n = read(in->fd, in->pending->data + in->pending->size,
+			in->pending->asize - in->pending->size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			in->eof = 1;
+		else
+			in->pending->size += n;
+	}
+
+	return in->pending->size - in->pos;
+}
+
+static const uint8_t *
+input_data(struct input *in)
+{
+	return in->map ? in->map : in->pending->data;
+}
+
+/* input_next • finds the next document; JSON documents are decoded into
+ * `decoded`. Returns 0 at the end of the input, -1 on malformed input */
+static int
+input_next(struct input *in, struct buf *decoded, size_t *offset, size_t *size, int *is_decoded)
+{
+	const uint8_t *data, *end;
+	size_t avail, i;
+	uint32_t length;
+
+	*is_decoded = 0;
+
+	switch (format) {
+	case FORMAT_LEN:
+		avail = input_fill(in, 4);
+		if (avail == 0)
+			return 0;
+		if (avail < 4)
+			return -1;
+
+		data = input_data(in) + in->pos;
+		length = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+
+		if (input_fill(in, 4 + (size_t)length) < 4 + (size_t)length)
+			return -1;
+
+		*offset = in->pos + 4;
+		*size = length;
+		in->pos += 4 + (size_t)length;
+		return 1;
+
+	case FORMAT_NUL:
+	case FORMAT_JSONL:
+		for (i = 0; ; ) {
+			avail = input_fill(in, i + 1);
+			if (avail == 0)
+				return 0;
+
+			data = input_data(in) + in->pos;
+			end = memchr(data + i, format == FORMAT_NUL ? '\0' : '\n', avail - i);
+
+			if (end || in->map || in->eof) {
+				size_t line = end ? (size_t)(end - data) : avail;
+
+				if (format == FORMAT_JSONL) {
+					*is_decoded = 1;
+					*offset = decoded->size;
+					if (!json_decode(decoded, data, line))
+						return -1;
+					*size = decoded->size - *offset;
+				} else {
+					*offset = in->pos;
+					*size = line;
+				}
+
+				in->pos += end ? line + 1 : line;
+				return 1;
+			}
+
+			i = avail;
+		}
+	}
+
+	return -1;
+}
+
+/**********
+ * OUTPUT *
+ **********/
+
+static void
+write_all(int fd, const uint8_t *data, size_t size)
+{
+	ssize_t n;
+
+	while (size > 0) {
+		n = write(fd, data, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			perror("snudown: write");
+			exit(1);
+		}
+		data += n;
+		size -= n;
+	}
+}
+
+static void
+write_document(struct buf *out, const struct buf *html)
+{
+	uint8_t prefix[4];
+
+	switch (format) {
+	case FORMAT_LEN:
+		prefix[0] = html->size & 0xFF;
+		prefix[1] = (html->size >> 8) & 0xFF;
+		prefix[2] = (html->size >> 16) & 0xFF;
+		prefix[3] = (html->size >> 24) & 0xFF;
+		bufput(out, prefix, 4);
+		bufput(out, html->data, html->size);
+		break;
+	case FORMAT_NUL:
+		bufput(out, html->data, html->size);
+		bufputc(out, '\0');
+		break;
+	case FORMAT_JSONL:
+		json_encode(out, html->data, html->size);
+		break;
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"usage: snudown [options] [file]\n"
+		"\n"
+		"  -f, --format len|nul|jsonl  input and output framing (default: len)\n"
+		"  -r, --renderer usertext|wiki\n"
+		"  -j, --threads N             rendering threads (default: 1)\n"
+		"      --nofollow              add rel=\"nofollow\" to links\n"
+		"      --target TARGET         add target=TARGET to links\n"
+		"      --toc                   render a table of contents\n"
+		"      --toc-id-prefix PREFIX  prefix for header ids\n"
+		"  -q, --quiet                 do not report throughput\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{"format", required_argument, NULL, 'f'},
+		{"renderer", required_argument, NULL, 'r'},
+		{"threads", required_argument, NULL, 'j'},
+		{"nofollow", no_argument, NULL, 'n'},
+		{"target", required_argument, NULL, 't'},
+		{"toc", no_argument, NULL, 'T'},
+		{"toc-id-prefix", required_argument, NULL, 'p'},
+		{"quiet", no_argument, NULL, 'q'},
+		{NULL, 0, NULL, 0}
+	};
+
+	struct worker workers[MAX_THREADS];
+	struct input in;
+	struct batch batch;
+	struct buf *decoded, *out;
+	size_t thread_count = 1, total_docs = 0, total_in = 0, total_out = 0;
+	size_t i, batch_bytes;
+	double started;
+	int c, status, is_decoded;
+
+	while ((c = getopt_long(argc, argv, "f:r:j:q", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'f':
+			if (strcmp(optarg, "len") == 0) format = FORMAT_LEN;
+			else if (strcmp(optarg, "nul") == 0) format = FORMAT_NUL;
+			else if (strcmp(optarg, "jsonl") == 0) format = FORMAT_JSONL;
+			else usage();
+			break;
+		case 'r':
+			if (strcmp(optarg, "usertext") == 0) renderer = RENDERER_USERTEXT;
+			else if (strcmp(optarg, "wiki") == 0) renderer = RENDERER_WIKI;
+			else usage();
+			break;
+		case 'j':
+			thread_count = strtoul(optarg, NULL, 10);
+			if (thread_count < 1 || thread_count > MAX_THREADS)
+				usage();
+			break;
+		case 'n': nofollow = 1; break;
+		case 't': target = optarg; break;
+		case 'T': enable_toc = 1; break;
+		case 'p': toc_id_prefix = optarg; break;
+		case 'q': quiet = 1; break;
+		default: usage();
+		}
+	}
+
+	if (optind + 1 < argc)
+		usage();
+
+	memset(&in, 0x0, sizeof in);
+	in.fd = STDIN_FILENO;
+
+	if (optind < argc) {
+		struct stat st;
+
+		in.fd = open(argv[optind], O_RDONLY);
+		if (in.fd < 0 || fstat(in.fd, &st) < 0) {
+			perror(argv[optind]);
+			return 1;
+		}
+
+		if (st.st_size > 0) {
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in.fd, 0);
+			if (map == MAP_FAILED) {
+				perror(argv[optind]);
+				return 1;
+			}
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			in.map = map;
+			in.map_size = st.st_size;
+		}
+	}
+
+	if (!in.map)
+		in.pending = bufnew(READ_UNIT);
+
+	for (i = 0; i < thread_count; ++i) {
+		if (!init_worker(&workers[i])) {
+			fprintf(stderr, "snudown: out of memory\n");
+			return 1;
+		}
+	}
+
+	batch.offsets = calloc(BATCH_DOCS, sizeof(size_t));
+	batch.sizes = calloc(BATCH_DOCS, sizeof(size_t));
+	batch.outputs = calloc(BATCH_DOCS, sizeof(struct buf *));
+	for (i = 0; i < BATCH_DOCS; ++i)
+		batch.outputs[i] = bufnew(1024);
+
+	decoded = bufnew(READ_UNIT);
+	out = bufnew(READ_UNIT);
+	started = now();
+	status = 0;
+
+	for (;;) {
+		/* gather a batch; stream input is copied out so the reader can
+		 * reuse its buffer, JSON input is decoded */
+		bufreset(decoded);
+		batch.count = 0;
+		batch_bytes = 0;
+
+		while (batch.count < BATCH_DOCS && batch_bytes < BATCH_BYTES) {
+			size_t offset, size;
+			int r = input_next(&in, decoded, &offset, &size, &is_decoded);
+
+			if (r < 0) {
+				fprintf(stderr, "snudown: malformed input after document %zu\n",
+					total_docs + batch.count);
+				status = 1;
+				break;
+			}
+
+			if (r == 0)
+				break;
+
+			if (!is_decoded && !in.map) {
+				/* keep the bytes in `decoded` too, the reader may move them */
+				size_t at = decoded->size;
+				bufput(decoded, in.pending->data + offset, size);
+				offset = at;
+				is_decoded = 1;
+			}
+
+			batch.offsets[batch.count] = offset;
+			batch.sizes[batch.count] = size;
+			batch.count++;
+			batch_bytes += size;
+		}
+
+		if (batch.count == 0)
+			break;
+
+		/* a batch draws either entirely from the map or from `decoded` */
+		if (in.map && format != FORMAT_JSONL)
+			batch.data = in.map;
+		else
+			batch.data = decoded->data;
+
+		batch.next = 0;
+		for (i = 1; i < thread_count; ++i) {
+			workers[i].batch = &batch;
+			pthread_create(&workers[i].thread, NULL, render_batch, &workers[i]);
+		}
+
+		workers[0].batch = &batch;
+		render_batch(&workers[0]);
+
+		for (i = 1; i < thread_count; ++i)
+			pthread_join(workers[i].thread, NULL);
+
+		bufreset(out);
+		for (i = 0; i < batch.count; ++i) {
+			write_document(out, batch.outputs[i]);
+			total_out += batch.outputs[i]->size;
+
+			if (out->size >= READ_UNIT) {
+				write_all(STDOUT_FILENO, out->data, out->size);
+				bufreset(out);
+			}
+		}
+		write_all(STDOUT_FILENO, out->data, out->size);
+
+		total_docs += batch.count;
+		total_in += batch_bytes;
+
+		if (status)
+			break;
+	}
+
+	if (!quiet) {
+		double elapsed = now() - started;
+
+		if (elapsed <= 0)
+			elapsed = 1e-9;
+
+		fprintf(stderr, "snudown: %zu documents, %.1f MB in, %.1f MB out, %.2fs, "
+			"%.0f docs/s, %.1f MB/s (%zu threads)\n",
+			total_docs, total_in / 1e6, total_out / 1e6, elapsed,
+			total_docs / elapsed, total_in / 1e6 / elapsed, thread_count);
+	}
+
+	return status;
+}
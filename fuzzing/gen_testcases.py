@@ -18,3 +18,10 @@ for i, md in enumerate(cases):
     test_path = os.path.join('testing', 'testcases', 'test_default_%d.md' % i)
     with open(test_path, 'w') as f:
         f.write(md)
+
+# the pathological shapes of the scaling tests, small enough for the
+# complexity harness to grow them
+for name, shape in test_snudown.scaling_cases.items():
+    test_path = os.path.join('testing', 'testcases', 'test_scaling_%s.md' % name.replace(' ', '_'))
+    with open(test_path, 'w') as f:
+        f.write(shape(256))
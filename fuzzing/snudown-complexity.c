@@ -0,0 +1,234 @@
+/*
+ * Fuzzing harness for algorithmic complexity: rather than checking the
+ * output, it measures what rendering each input costs per byte, and
+ * crashes on inputs that cost too much so the fuzzer keeps them.
+ *
+ * An input is rendered as is and repeated TILES times. It is a finding
+ * when the repeated copy costs more than SNUDOWN_MAX_GROWTH times as much
+ * per byte (4 by default), which is how super-linear shapes show up at
+ * the sizes fuzzers work with, or when it costs more per byte than
+ * SNUDOWN_MAX_COST.
+ *
+ * Cost is counted in instructions retired, through perf_event_open where
+ * the kernel allows it, and in thread CPU time otherwise; findings on CPU
+ * time are measured again before being reported, to rule out noise.
+ *
+ * Built with -fsanitize=fuzzer it's a libFuzzer target, which AFL++ also
+ * runs when built with afl-clang-fast. Built with -DSNUDOWN_STANDALONE it
+ * checks the files named on the command line, or stdin, for triage and
+ * for classic AFL. Either way, testing/testcases from gen_testcases.py
+ * makes a seed corpus.
+ */
+
+#include "markdown.h"
+#include "html.h"
+#include "buffer.h"
+#include "renderers.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define TILES 16
+#define READ_UNIT 1024
+
+/* default SNUDOWN_MAX_COST in instructions and in nanoseconds per byte */
+#define MAX_INSTRUCTIONS 50000
+#define MAX_NANOSECONDS 5000
+
+/* the renderers of snudown.markdown(), set up the same way */
+struct renderer {
+	const char *name;
+	int mode;
+	struct module_state state;
+	struct sd_markdown *markdown;
+};
+
+static struct renderer renderers[] = {
+	{ "usertext", RENDERER_USERTEXT },
+	{ "wiki", RENDERER_WIKI },
+};
+
+static struct buf *tiled, *ob;
+static double max_growth, max_cost;
+
+/* perf_event_open counter of the instructions this thread retires, or -1
+ * to fall back on CPU time */
+static int instructions = -1;
+
+static void
+open_counter(void)
+{
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof attr;
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	instructions = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static double
+env_or(const char *name, double fallback)
+{
+	const char *value = getenv(name);
+	return value ? atof(value) : fallback;
+}
+
+static void
+init(void)
+{
+	size_t k;
+
+	for (k = 0; k < RENDERER_COUNT; ++k) {
+		renderers[k].markdown = snudown_make_renderer(&renderers[k].state,
+			snudown_render_flags(renderers[k].mode), snudown_default_md_flags, 0);
+		if (!renderers[k].markdown)
+			abort();
+	}
+
+	tiled = bufnew(READ_UNIT);
+	ob = bufnew(READ_UNIT);
+
+	open_counter();
+	max_growth = env_or("SNUDOWN_MAX_GROWTH", 4.0);
+	max_cost = env_or("SNUDOWN_MAX_COST",
+		instructions >= 0 ? MAX_INSTRUCTIONS : MAX_NANOSECONDS);
+}
+
+/* cost per byte of rendering data, in instructions or nanoseconds */
+static double
+cost(struct renderer *r, const uint8_t *data, size_t size)
+{
+	struct timespec beg, end;
+	uint64_t count = 0;
+
+	ob->size = 0;
+
+#ifdef __linux__
+	if (instructions >= 0) {
+		ioctl(instructions, PERF_EVENT_IOC_RESET, 0);
+		ioctl(instructions, PERF_EVENT_IOC_ENABLE, 0);
+		sd_markdown_render(ob, data, size, r->markdown);
+		ioctl(instructions, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(instructions, &count, sizeof count) != sizeof count)
+			count = 0;
+		return (double)count / size;
+	}
+#endif
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &beg);
+	sd_markdown_render(ob, data, size, r->markdown);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	return ((end.tv_sec - beg.tv_sec) * 1e9 + (end.tv_nsec - beg.tv_nsec)) / size;
+}
+
+/* whether data costs too much to render; CPU times are the best of a
+ * few runs, once they look too high */
+static int
+too_costly(struct renderer *r, const uint8_t *data, size_t size, double *single, double *repeated)
+{
+	int runs = instructions >= 0 ? 1 : 5, i;
+	double c;
+
+	*single = cost(r, data, size);
+	*repeated = cost(r, tiled->data, tiled->size);
+
+	for (i = 1; i < runs; ++i) {
+		if (*repeated <= *single * max_growth && *repeated <= max_cost)
+			break;
+
+		if ((c = cost(r, data, size)) < *single)
+			*single = c;
+		if ((c = cost(r, tiled->data, tiled->size)) < *repeated)
+			*repeated = c;
+	}
+
+	return *repeated > *single * max_growth || *repeated > max_cost;
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	double single, repeated;
+	size_t i, k;
+
+	if (!tiled)
+		init();
+
+	if (size == 0)
+		return 0;
+
+	tiled->size = 0;
+	for (i = 0; i < TILES; ++i)
+		bufput(tiled, data, size);
+
+	for (k = 0; k < RENDERER_COUNT; ++k) {
+		if (!too_costly(&renderers[k], data, size, &single, &repeated))
+			continue;
+
+		fprintf(stderr, "slow input (%s): %.0f %s per byte, %.0f repeated %d times\n",
+			renderers[k].name, single, instructions >= 0 ? "instructions" : "ns",
+			repeated, TILES);
+		abort();
+	}
+
+	return 0;
+}
+
+#ifdef SNUDOWN_STANDALONE
+static int
+check(FILE *in)
+{
+	struct buf *ib = bufnew(READ_UNIT);
+	size_t size_read;
+
+	bufgrow(ib, READ_UNIT);
+	while ((size_read = fread(ib->data + ib->size, 1, ib->asize - ib->size, in)) > 0) {
+		ib->size += size_read;
+		bufgrow(ib, ib->size + READ_UNIT);
+	}
+
+	LLVMFuzzerTestOneInput(ib->data, ib->size);
+	bufrelease(ib);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *in;
+	int i;
+
+	if (argc < 2)
+		return check(stdin);
+
+	for (i = 1; i < argc; ++i) {
+		if ((in = fopen(argv[i], "rb")) == NULL) {
+			perror(argv[i]);
+			return 1;
+		}
+		fprintf(stderr, "** %s\n", argv[i]);
+		check(in);
+		fclose(in);
+	}
+
+	return 0;
+}
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Searches for inputs that snudown renders in super-linear time.
+ *
+ * Each candidate is a short unit of markdown fragments, repeated to fill a
+ * small and a large document. A candidate whose render time per byte grows
+ * by more than the threshold between the two is measured again, and if it
+ * still grows it is printed along with its growth factor:
+ *
+ *     ./build/snudown-scaling [-n candidates] [-s seed] [-t threshold]
+ *
+ * Documents are rendered with the usertext and wiki renderers, set up as
+ * snudown.markdown() sets them up. The exit status is 1 if anything was
+ * found.
+ */
+
+#include "markdown.h"
+#include "html.h"
+#include "buffer.h"
+#include "renderers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SMALL_SIZE (4 * 1024)
+#define LARGE_SIZE (32 * 1024)
+#define MAX_UNIT 8
+
+/* the openers, closers and line prefixes behind past incidents */
+static const char *fragments[] = {
+	"[", "]", "(", ")", "![", "[a]: /b\n", "\\",
+	"*", "_", "**", "~~", "^", "^(", "`",
+	">", "> ", ">!", "!<", "\n", "\n\n", " ", "    ", "a", "|", "|-",
+	"<", "<div>", "</div>", "<a", "&", "&#", "@", "http://", "/r/", "www.",
+	"* ", "1. ", "  * ", "---", "```",
+};
+
+#define FRAGMENT_COUNT (sizeof(fragments) / sizeof(fragments[0]))
+
+struct renderer {
+	const char *name;
+	int mode;
+	struct module_state state;
+	struct sd_markdown *markdown;
+};
+
+static struct renderer renderers[] = {
+	{ "usertext", RENDERER_USERTEXT },
+	{ "wiki", RENDERER_WIKI },
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* fills doc with copies of unit up to size bytes */
+static void
+fill(struct buf *doc, const struct buf *unit, size_t size)
+{
+	doc->size = 0;
+	while (doc->size + unit->size <= size)
+		bufput(doc, unit->data, unit->size);
+	bufput(doc, unit->data, size - doc->size);
+}
+
+/* best render time of doc per byte, out of a few runs */
+static double
+time_per_byte(struct renderer *r, struct buf *ob, const struct buf *doc, int runs)
+{
+	double best = 0, t;
+	int i;
+
+	for (i = 0; i < runs; ++i) {
+		ob->size = 0;
+		t = now();
+		sd_markdown_render(ob, doc->data, doc->size, r->markdown);
+		t = now() - t;
+		if (i == 0 || t < best)
+			best = t;
+	}
+
+	return best / doc->size;
+}
+
+/* how much slower per byte the large document renders than the small */
+static double
+growth(struct renderer *r, struct buf *ob, struct buf *doc, const struct buf *unit, int runs)
+{
+	double small, large;
+
+	fill(doc, unit, SMALL_SIZE);
+	small = time_per_byte(r, ob, doc, runs * 4);
+	fill(doc, unit, LARGE_SIZE);
+	large = time_per_byte(r, ob, doc, runs);
+
+	return large / small;
+}
+
+static void
+print_unit(const struct buf *unit)
+{
+	size_t i;
+
+	putchar('"');
+	for (i = 0; i < unit->size; ++i) {
+		uint8_t c = unit->data[i];
+		if (c == '\n')
+			fputs("\\n", stdout);
+		else if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+int
+main(int argc, char **argv)
+{
+	long candidates = 10000, n;
+	unsigned int seed = (unsigned int)time(NULL);
+	double threshold = 3.0, g;
+	struct buf *unit, *doc, *ob;
+	size_t i, k, parts;
+	int opt, found = 0;
+
+	while ((opt = getopt(argc, argv, "n:s:t:")) != -1) {
+		switch (opt) {
+		case 'n': candidates = atol(optarg); break;
+		case 's': seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+		case 't': threshold = atof(optarg); break;
+		default:
+			fprintf(stderr, "usage: %s [-n candidates] [-s seed] [-t threshold]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	for (k = 0; k < RENDERER_COUNT; ++k) {
+		renderers[k].markdown = snudown_make_renderer(&renderers[k].state,
+			snudown_render_flags(renderers[k].mode), snudown_default_md_flags, 0);
+		if (!renderers[k].markdown) {
+			fprintf(stderr, "out of memory\n");
+			return 2;
+		}
+	}
+
+	printf("seed %u, %ld candidates, threshold %.1f\n", seed, candidates, threshold);
+	srand(seed);
+
+	unit = bufnew(64);
+	doc = bufnew(LARGE_SIZE);
+	ob = bufnew(LARGE_SIZE * 4);
+
+	for (n = 0; n < candidates; ++n) {
+		unit->size = 0;
+		parts = 1 + rand() % MAX_UNIT;
+		for (i = 0; i < parts; ++i)
+			bufputs(unit, fragments[rand() % FRAGMENT_COUNT]);
+
+		for (k = 0; k < RENDERER_COUNT; ++k) {
+			struct renderer *r = &renderers[k];
+
+			if (growth(r, ob, doc, unit, 1) < threshold)
+				continue;
+
+			/* ruling out a noisy measurement */
+			g = growth(r, ob, doc, unit, 3);
+			if (g < threshold)
+				continue;
+
+			printf("%.1fx (%s): ", g, r->name);
+			print_unit(unit);
+			putchar('\n');
+			fflush(stdout);
+			found = 1;
+			break;
+		}
+	}
+
+	for (k = 0; k < RENDERER_COUNT; ++k)
+		sd_markdown_free(renderers[k].markdown);
+	bufrelease(unit);
+	bufrelease(doc);
+	bufrelease(ob);
+
+	return found;
+}
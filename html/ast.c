@@ -0,0 +1,1069 @@
+/*
+ * Copyright (c) 2015, reddit inc.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "markdown.h"
+#include "html.h"
+#include "ast.h"
+#include "stack.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/*
+ * The parser hands every callback the output of its children as a
+ * buffer, so the AST renderer "renders" a node as a reference to it:
+ * a NUL byte followed by the node index in AST_REF_DIGITS 7-bit digits,
+ * each with the high bit set. Plain text is copied through verbatim
+ * (minus NUL bytes), which keeps the parser's own fix-ups on `ob`
+ * (autolink rewinds, linebreak space trimming) working unchanged. When
+ * a container callback fires, the runs of text in its buffer become
+ * TEXT children and the references become its other children.
+ */
+#define AST_REF_MARK 0
+#define AST_REF_DIGITS 4
+
+/* ast_link: tree links of a node while the document is being parsed */
+struct ast_link {
+	int32_t first_child;
+	int32_t last_child;
+	int32_t next_sibling;
+};
+
+const char *sdast_type_names[SD_AST_TYPE_COUNT] = {
+	"DOCUMENT",
+	"BLOCKCODE",
+	"BLOCKQUOTE",
+	"BLOCKSPOILER",
+	"BLOCKHTML",
+	"HEADER",
+	"HRULE",
+	"LIST",
+	"LISTITEM",
+	"PARAGRAPH",
+	"TABLE",
+	"TABLE_HEADER",
+	"TABLE_BODY",
+	"TABLE_ROW",
+	"TABLE_CELL",
+	"AUTOLINK",
+	"CODESPAN",
+	"SPOILERSPAN",
+	"DOUBLE_EMPHASIS",
+	"EMPHASIS",
+	"IMAGE",
+	"LINEBREAK",
+	"LINK",
+	"RAW_HTML",
+	"TRIPLE_EMPHASIS",
+	"STRIKETHROUGH",
+	"SUPERSCRIPT",
+	"ENTITY",
+	"TEXT",
+};
+
+#define AST_NODE(ast, id) (((struct sd_ast_node *)(ast)->work_nodes->data) + (id))
+#define AST_LINK(ast, id) (((struct ast_link *)(ast)->work_links->data) + (id))
+
+static struct sd_ast_slice
+ast_string(struct sd_ast *ast, const uint8_t *data, size_t size)
+{
+	struct sd_ast_slice slice;
+
+	slice.offset = (uint32_t)ast->strings->size;
+	slice.size = (uint32_t)size;
+	bufput(ast->strings, data, size);
+
+	return slice;
+}
+
+static int32_t
+ast_new_node(struct sd_ast *ast, enum sd_ast_type type)
+{
+	struct sd_ast_node node;
+	struct ast_link link;
+
+	memset(&node, 0x0, sizeof(node));
+	node.type = type;
+	node.parent = -1;
+
+	link.first_child = link.last_child = link.next_sibling = -1;
+
+	bufput(ast->work_nodes, &node, sizeof(node));
+	bufput(ast->work_links, &link, sizeof(link));
+
+	return (int32_t)(ast->work_nodes->size / sizeof(node)) - 1;
+}
+
+static void
+ast_append_child(struct sd_ast *ast, int32_t parent, int32_t child)
+{
+	struct ast_link *plink = AST_LINK(ast, parent);
+
+	if (plink->last_child >= 0)
+		AST_LINK(ast, plink->last_child)->next_sibling = child;
+	else
+		plink->first_child = child;
+
+	plink->last_child = child;
+	AST_NODE(ast, child)->parent = parent;
+}
+
+static void
+ast_put_ref(struct buf *ob, int32_t id)
+{
+	uint8_t ref[AST_REF_DIGITS + 1];
+	size_t i;
+
+	ref[0] = AST_REF_MARK;
+	for (i = 0; i < AST_REF_DIGITS; ++i)
+		ref[i + 1] = 0x80 | ((id >> (7 * i)) & 0x7f);
+
+	bufput(ob, ref, sizeof(ref));
+}
+
+static int32_t
+ast_get_ref(const uint8_t *data)
+{
+	int32_t id = 0;
+	size_t i;
+
+	for (i = 0; i < AST_REF_DIGITS; ++i)
+		id |= (int32_t)(data[i + 1] & 0x7f) << (7 * i);
+
+	return id;
+}
+
+/* ast_adopt • turns the rendered contents of a container into children */
+static void
+ast_adopt(struct sd_ast *ast, int32_t parent, const struct buf *text)
+{
+	size_t i = 0, org;
+
+	if (!text)
+		return;
+
+	while (i < text->size) {
+		org = i;
+		while (i < text->size && text->data[i] != AST_REF_MARK)
+			i++;
+
+		if (i > org) {
+			int32_t child = ast_new_node(ast, SD_AST_TEXT);
+			AST_NODE(ast, child)->text = ast_string(ast, text->data + org, i - org);
+			ast_append_child(ast, parent, child);
+		}
+
+		if (i + AST_REF_DIGITS >= text->size)
+			break;
+
+		ast_append_child(ast, parent, ast_get_ref(text->data + i));
+		i += AST_REF_DIGITS + 1;
+	}
+}
+
+/* ast_container • new node adopting `text`, referenced from `ob` */
+static int32_t
+ast_container(struct buf *ob, struct sd_ast *ast, enum sd_ast_type type, const struct buf *text)
+{
+	int32_t id = ast_new_node(ast, type);
+	ast_adopt(ast, id, text);
+	ast_put_ref(ob, id);
+	return id;
+}
+
+/* ast_literal • new leaf node with `text` as its contents */
+static int32_t
+ast_literal(struct buf *ob, struct sd_ast *ast, enum sd_ast_type type, const struct buf *text)
+{
+	int32_t id = ast_new_node(ast, type);
+	if (text && text->size)
+		AST_NODE(ast, id)->text = ast_string(ast, text->data, text->size);
+	ast_put_ref(ob, id);
+	return id;
+}
+
+/*****************
+ * AST CALLBACKS *
+ *****************/
+
+/* The return values mirror the HTML renderer, so that the parser makes
+ * the same decisions on both and the tree matches the rendered HTML */
+
+static void
+ast_blockcode(struct buf *ob, const struct buf *text, const struct buf *lang, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id = ast_literal(ob, ast, SD_AST_BLOCKCODE, text);
+
+	if (lang && lang->size)
+		AST_NODE(ast, id)->title = ast_string(ast, lang->data, lang->size);
+}
+
+static void
+ast_blockquote(struct buf *ob, const struct buf *text, void *opaque)
+{
+	ast_container(ob, opaque, SD_AST_BLOCKQUOTE, text);
+}
+
+static void
+ast_blockspoiler(struct buf *ob, const struct buf *text, void *opaque)
+{
+	ast_container(ob, opaque, SD_AST_BLOCKSPOILER, text);
+}
+
+static void
+ast_blockhtml(struct buf *ob, const struct buf *text, void *opaque)
+{
+	ast_literal(ob, opaque, SD_AST_BLOCKHTML, text);
+}
+
+static void
+ast_header(struct buf *ob, const struct buf *text, int level, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id = ast_container(ob, ast, SD_AST_HEADER, text);
+	AST_NODE(ast, id)->value = level;
+}
+
+static void
+ast_hrule(struct buf *ob, void *opaque)
+{
+	ast_container(ob, opaque, SD_AST_HRULE, NULL);
+}
+
+static void
+ast_list(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id = ast_container(ob, ast, SD_AST_LIST, text);
+	AST_NODE(ast, id)->flags = flags;
+}
+
+static void
+ast_listitem(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id = ast_container(ob, ast, SD_AST_LISTITEM, text);
+	AST_NODE(ast, id)->flags = flags;
+}
+
+static void
+ast_paragraph(struct buf *ob, const struct buf *text, void *opaque)
+{
+	ast_container(ob, opaque, SD_AST_PARAGRAPH, text);
+}
+
+static void
+ast_table(struct buf *ob, const struct buf *header, const struct buf *body, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id = ast_new_node(ast, SD_AST_TABLE);
+	int32_t part;
+
+	part = ast_new_node(ast, SD_AST_TABLE_HEADER);
+	ast_adopt(ast, part, header);
+	ast_append_child(ast, id, part);
+
+	part = ast_new_node(ast, SD_AST_TABLE_BODY);
+	ast_adopt(ast, part, body);
+	ast_append_child(ast, id, part);
+
+	ast_put_ref(ob, id);
+}
+
+static void
+ast_table_row(struct buf *ob, const struct buf *text, void *opaque)
+{
+	ast_container(ob, opaque, SD_AST_TABLE_ROW, text);
+}
+
+static void
+ast_table_cell(struct buf *ob, const struct buf *text, int flags, void *opaque, int col_span)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id = ast_container(ob, ast, SD_AST_TABLE_CELL, text);
+	AST_NODE(ast, id)->flags = flags;
+	AST_NODE(ast, id)->value = col_span;
+}
+
+static int
+ast_autolink(struct buf *ob, const struct buf *link, enum mkd_autolink type, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id;
+
+	if (!link || !link->size)
+		return 0;
+
+	if ((ast->flags & HTML_SAFELINK) != 0 &&
+		!sd_autolink_issafe(link->data, link->size) &&
+		type != MKDA_EMAIL)
+		return 0;
+
+	id = ast_container(ob, ast, SD_AST_AUTOLINK, NULL);
+	AST_NODE(ast, id)->flags = type;
+	AST_NODE(ast, id)->link = ast_string(ast, link->data, link->size);
+	return 1;
+}
+
+static int
+ast_codespan(struct buf *ob, const struct buf *text, void *opaque)
+{
+	ast_literal(ob, opaque, SD_AST_CODESPAN, text);
+	return 1;
+}
+
+static int
+ast_spoilerspan(struct buf *ob, const struct buf *text, void *opaque)
+{
+	if (!text || !text->size)
+		return 0;
+
+	ast_container(ob, opaque, SD_AST_SPOILERSPAN, text);
+	return 1;
+}
+
+static int
+ast_double_emphasis(struct buf *ob, const struct buf *text, void *opaque)
+{
+	if (!text || !text->size)
+		return 0;
+
+	ast_container(ob, opaque, SD_AST_DOUBLE_EMPHASIS, text);
+	return 1;
+}
+
+static int
+ast_emphasis(struct buf *ob, const struct buf *text, void *opaque)
+{
+	if (!text || !text->size)
+		return 0;
+
+	ast_container(ob, opaque, SD_AST_EMPHASIS, text);
+	return 1;
+}
+
+static int
+ast_image(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *alt, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id;
+
+	if (!link || !link->size)
+		return 0;
+
+	id = ast_literal(ob, ast, SD_AST_IMAGE, alt);
+	AST_NODE(ast, id)->link = ast_string(ast, link->data, link->size);
+
+	if (title && title->size)
+		AST_NODE(ast, id)->title = ast_string(ast, title->data, title->size);
+
+	return 1;
+}
+
+static int
+ast_linebreak(struct buf *ob, void *opaque)
+{
+	ast_container(ob, opaque, SD_AST_LINEBREAK, NULL);
+	return 1;
+}
+
+static int
+ast_link(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *content, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id;
+
+	if (link != NULL && (ast->flags & HTML_SAFELINK) != 0 && !sd_autolink_issafe(link->data, link->size))
+		return 0;
+
+	id = ast_container(ob, ast, SD_AST_LINK, content);
+
+	if (link && link->size)
+		AST_NODE(ast, id)->link = ast_string(ast, link->data, link->size);
+
+	if (title && title->size)
+		AST_NODE(ast, id)->title = ast_string(ast, title->data, title->size);
+
+	return 1;
+}
+
+static int
+ast_raw_html(struct buf *ob, const struct buf *text, void *opaque)
+{
+	ast_literal(ob, opaque, SD_AST_RAW_HTML, text);
+	return 1;
+}
+
+static int
+ast_triple_emphasis(struct buf *ob, const struct buf *text, void *opaque)
+{
+	if (!text || !text->size)
+		return 0;
+
+	ast_container(ob, opaque, SD_AST_TRIPLE_EMPHASIS, text);
+	return 1;
+}
+
+static int
+ast_strikethrough(struct buf *ob, const struct buf *text, void *opaque)
+{
+	if (!text || !text->size)
+		return 0;
+
+	ast_container(ob, opaque, SD_AST_STRIKETHROUGH, text);
+	return 1;
+}
+
+static int
+ast_superscript(struct buf *ob, const struct buf *text, void *opaque)
+{
+	if (!text || !text->size)
+		return 0;
+
+	ast_container(ob, opaque, SD_AST_SUPERSCRIPT, text);
+	return 1;
+}
+
+static void
+ast_entity(struct buf *ob, const struct buf *entity, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id = ast_literal(ob, ast, SD_AST_ENTITY, entity);
+
+	/* same normalization the parser applies without a callback:
+	 * `&#X3E;` becomes `&#x3E;` */
+	if (entity->size > 2 && entity->data[1] == '#' && entity->data[2] == 'X')
+		ast->strings->data[AST_NODE(ast, id)->text.offset + 2] = 'x';
+}
+
+static void
+ast_normal_text(struct buf *ob, const struct buf *text, void *opaque)
+{
+	size_t i = 0, org;
+
+	if (!text)
+		return;
+
+	/* NUL is reserved for node references */
+	while (i < text->size) {
+		org = i;
+		while (i < text->size && text->data[i] != AST_REF_MARK)
+			i++;
+
+		if (i > org)
+			bufput(ob, text->data + org, i - org);
+
+		i++;
+	}
+}
+
+static void
+ast_doc_footer(struct buf *ob, void *opaque)
+{
+	struct sd_ast *ast = opaque;
+	int32_t id = ast_new_node(ast, SD_AST_DOCUMENT);
+
+	ast_adopt(ast, id, ob);
+	ob->size = 0;
+	ast_put_ref(ob, id);
+}
+
+/*******************
+ * SERIALIZED FORM *
+ *******************/
+
+/*
+ * The serialized tree is the node array in document order, written as:
+ *
+ *	header: "sd" AST_SERIAL_VERSION
+ *	node:   type | AST_HAS_TEXT | AST_HAS_LINK | AST_HAS_TITLE
+ *	        [flags] [value]	varints, for the types that use them
+ *	        [text] [link] [title]	varint length + bytes, when present
+ *	        [child count] [children...]	for container types
+ *
+ * Rendering it replays the recorded callbacks in the order the parser
+ * made them, so any renderer (and any renderer options, such as link
+ * attributes) can be applied when the tree is expanded.
+ */
+#define AST_SERIAL_VERSION 1
+#define AST_SERIAL_MAX_DEPTH 64
+
+#define AST_TYPE_MASK 0x1f
+#define AST_HAS_TEXT 0x20
+#define AST_HAS_LINK 0x40
+#define AST_HAS_TITLE 0x80
+
+enum {
+	AST_USES_FLAGS = (1 << 0),
+	AST_USES_VALUE = (1 << 1),
+	AST_IS_LEAF = (1 << 2),
+};
+
+static const uint8_t ast_type_fields[SD_AST_TYPE_COUNT] = {
+	0,							/* DOCUMENT */
+	AST_IS_LEAF,				/* BLOCKCODE */
+	0,							/* BLOCKQUOTE */
+	0,							/* BLOCKSPOILER */
+	AST_IS_LEAF,				/* BLOCKHTML */
+	AST_USES_VALUE,				/* HEADER */
+	AST_IS_LEAF,				/* HRULE */
+	AST_USES_FLAGS,				/* LIST */
+	AST_USES_FLAGS,				/* LISTITEM */
+	0,							/* PARAGRAPH */
+	0,							/* TABLE */
+	0,							/* TABLE_HEADER */
+	0,							/* TABLE_BODY */
+	0,							/* TABLE_ROW */
+	AST_USES_FLAGS | AST_USES_VALUE,	/* TABLE_CELL */
+	AST_USES_FLAGS | AST_IS_LEAF,	/* AUTOLINK */
+	AST_IS_LEAF,				/* CODESPAN */
+	0,							/* SPOILERSPAN */
+	0,							/* DOUBLE_EMPHASIS */
+	0,							/* EMPHASIS */
+	AST_IS_LEAF,				/* IMAGE */
+	AST_IS_LEAF,				/* LINEBREAK */
+	0,							/* LINK */
+	AST_IS_LEAF,				/* RAW_HTML */
+	0,							/* TRIPLE_EMPHASIS */
+	0,							/* STRIKETHROUGH */
+	0,							/* SUPERSCRIPT */
+	AST_IS_LEAF,				/* ENTITY */
+	AST_IS_LEAF,				/* TEXT */
+};
+
+static void
+ast_put_varint(struct buf *ob, uint32_t value)
+{
+	uint8_t out[5];
+	size_t n = 0;
+
+	while (value >= 0x80) {
+		out[n++] = 0x80 | (value & 0x7f);
+		value >>= 7;
+	}
+	out[n++] = (uint8_t)value;
+
+	bufput(ob, out, n);
+}
+
+static void
+ast_put_slice(struct buf *ob, const struct sd_ast *ast, struct sd_ast_slice slice)
+{
+	ast_put_varint(ob, slice.size);
+	bufput(ob, ast->strings->data + slice.offset, slice.size);
+}
+
+/* ast_reader: cursor over a serialized tree, plus the work buffers used
+ * to render the children of each nesting level */
+struct ast_reader {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+
+	const struct sd_callbacks *cb;
+	void *opaque;
+	struct stack work_bufs;
+	struct buf *link_work;
+};
+
+static int
+ast_get_varint(struct ast_reader *rd, uint32_t *value)
+{
+	uint32_t result = 0;
+	size_t shift;
+
+	for (shift = 0; shift < 35 && rd->pos < rd->size; shift += 7) {
+		uint8_t c = rd->data[rd->pos++];
+		result |= (uint32_t)(c & 0x7f) << shift;
+
+		if ((c & 0x80) == 0) {
+			*value = result;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int
+ast_get_slice(struct ast_reader *rd, struct buf *slice)
+{
+	uint32_t size;
+
+	if (ast_get_varint(rd, &size) < 0 || size > rd->size - rd->pos)
+		return -1;
+
+	slice->data = (uint8_t *)rd->data + rd->pos;
+	slice->size = size;
+	slice->asize = 0;
+	slice->unit = 0;
+
+	rd->pos += size;
+	return 0;
+}
+
+static struct buf *
+ast_work_buf(struct ast_reader *rd, size_t depth)
+{
+	while (rd->work_bufs.size <= depth)
+		stack_push(&rd->work_bufs, bufnew(256));
+
+	((struct buf *)rd->work_bufs.item[depth])->size = 0;
+	return rd->work_bufs.item[depth];
+}
+
+static int ast_render_node(struct buf *ob, struct ast_reader *rd, size_t depth);
+
+/* ast_render_children • renders `count` nodes, each straight into `ob` */
+static int
+ast_render_children(struct buf *ob, struct ast_reader *rd, size_t depth)
+{
+	uint32_t count, i;
+
+	if (ast_get_varint(rd, &count) < 0)
+		return -1;
+
+	for (i = 0; i < count; ++i) {
+		if (ast_render_node(ob, rd, depth) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+ast_render_node(struct buf *ob, struct ast_reader *rd, size_t depth)
+{
+	const struct sd_callbacks *cb = rd->cb;
+	struct buf text = { 0, 0, 0, 0 }, link = { 0, 0, 0, 0 }, title = { 0, 0, 0, 0 };
+	struct buf *work = NULL;
+	uint32_t flags = 0, value = 0;
+	uint8_t head, type;
+
+	if (depth >= AST_SERIAL_MAX_DEPTH || rd->pos >= rd->size)
+		return -1;
+
+	head = rd->data[rd->pos++];
+	type = head & AST_TYPE_MASK;
+
+	if (type >= SD_AST_TYPE_COUNT)
+		return -1;
+
+	if ((ast_type_fields[type] & AST_USES_FLAGS) && ast_get_varint(rd, &flags) < 0)
+		return -1;
+
+	if ((ast_type_fields[type] & AST_USES_VALUE) && ast_get_varint(rd, &value) < 0)
+		return -1;
+
+	if (((head & AST_HAS_TEXT) && ast_get_slice(rd, &text) < 0) ||
+		((head & AST_HAS_LINK) && ast_get_slice(rd, &link) < 0) ||
+		((head & AST_HAS_TITLE) && ast_get_slice(rd, &title) < 0))
+		return -1;
+
+	if (type == SD_AST_DOCUMENT)
+		return ast_render_children(ob, rd, depth + 1);
+
+	if (!(ast_type_fields[type] & AST_IS_LEAF)) {
+		/* tables hand their header and body over separately */
+		if (type == SD_AST_TABLE) {
+			struct buf *header = ast_work_buf(rd, 2 * depth);
+			struct buf *body = ast_work_buf(rd, 2 * depth + 1);
+			uint32_t count;
+
+			if (ast_get_varint(rd, &count) < 0 || count != 2 ||
+				rd->pos >= rd->size || (rd->data[rd->pos] & AST_TYPE_MASK) != SD_AST_TABLE_HEADER)
+				return -1;
+
+			rd->pos++;
+			if (ast_render_children(header, rd, depth + 1) < 0)
+				return -1;
+
+			if (rd->pos >= rd->size || (rd->data[rd->pos] & AST_TYPE_MASK) != SD_AST_TABLE_BODY)
+				return -1;
+
+			rd->pos++;
+			if (ast_render_children(body, rd, depth + 1) < 0)
+				return -1;
+
+			if (cb->table)
+				cb->table(ob, header, body, rd->opaque);
+			return 0;
+		}
+
+		work = ast_work_buf(rd, 2 * depth);
+		if (ast_render_children(work, rd, depth + 1) < 0)
+			return -1;
+	}
+
+	switch (type) {
+	case SD_AST_BLOCKCODE:
+		if (cb->blockcode)
+			cb->blockcode(ob, &text, title.size ? &title : NULL, rd->opaque);
+		break;
+
+	case SD_AST_BLOCKQUOTE:
+		if (cb->blockquote)
+			cb->blockquote(ob, work, rd->opaque);
+		break;
+
+	case SD_AST_BLOCKSPOILER:
+		if (cb->blockspoiler)
+			cb->blockspoiler(ob, work, rd->opaque);
+		break;
+
+	case SD_AST_BLOCKHTML:
+		if (cb->blockhtml)
+			cb->blockhtml(ob, &text, rd->opaque);
+		break;
+
+	case SD_AST_HEADER:
+		if (cb->header)
+			cb->header(ob, work, (int)value, rd->opaque);
+		break;
+
+	case SD_AST_HRULE:
+		if (cb->hrule)
+			cb->hrule(ob, rd->opaque);
+		break;
+
+	case SD_AST_LIST:
+		if (cb->list)
+			cb->list(ob, work, (int)flags, rd->opaque);
+		break;
+
+	case SD_AST_LISTITEM:
+		if (cb->listitem)
+			cb->listitem(ob, work, (int)flags, rd->opaque);
+		break;
+
+	case SD_AST_PARAGRAPH:
+		if (cb->paragraph)
+			cb->paragraph(ob, work, rd->opaque);
+		break;
+
+	case SD_AST_TABLE_ROW:
+		if (cb->table_row)
+			cb->table_row(ob, work, rd->opaque);
+		break;
+
+	case SD_AST_TABLE_CELL:
+		if (cb->table_cell)
+			cb->table_cell(ob, work, (int)flags, rd->opaque, (int)value);
+		break;
+
+	case SD_AST_AUTOLINK:
+		/* the autolink renderer inspects the link with bufprefix(),
+		 * which wants a writable buffer */
+		rd->link_work->size = 0;
+		bufput(rd->link_work, link.data, link.size);
+		if (!cb->autolink || !cb->autolink(ob, rd->link_work, (enum mkd_autolink)flags, rd->opaque))
+			bufput(ob, link.data, link.size);
+		break;
+
+	case SD_AST_CODESPAN:
+		if (cb->codespan)
+			cb->codespan(ob, text.size ? &text : NULL, rd->opaque);
+		break;
+
+	case SD_AST_IMAGE:
+		if (cb->image)
+			cb->image(ob, &link, &title, &text, rd->opaque);
+		break;
+
+	case SD_AST_LINEBREAK:
+		if (cb->linebreak)
+			cb->linebreak(ob, rd->opaque);
+		break;
+
+	case SD_AST_LINK:
+		if (!cb->link || !cb->link(ob, &link, &title, work, rd->opaque))
+			bufput(ob, work->data, work->size);
+		break;
+
+	case SD_AST_RAW_HTML:
+		if (!cb->raw_html_tag || !cb->raw_html_tag(ob, &text, rd->opaque))
+			bufput(ob, text.data, text.size);
+		break;
+
+	case SD_AST_SPOILERSPAN:
+	case SD_AST_DOUBLE_EMPHASIS:
+	case SD_AST_EMPHASIS:
+	case SD_AST_TRIPLE_EMPHASIS:
+	case SD_AST_STRIKETHROUGH:
+	case SD_AST_SUPERSCRIPT: {
+		int (*render_method)(struct buf *ob, const struct buf *text, void *opaque);
+
+		switch (type) {
+		case SD_AST_SPOILERSPAN: render_method = cb->spoilerspan; break;
+		case SD_AST_DOUBLE_EMPHASIS: render_method = cb->double_emphasis; break;
+		case SD_AST_EMPHASIS: render_method = cb->emphasis; break;
+		case SD_AST_TRIPLE_EMPHASIS: render_method = cb->triple_emphasis; break;
+		case SD_AST_STRIKETHROUGH: render_method = cb->strikethrough; break;
+		default: render_method = cb->superscript; break;
+		}
+
+		if (!render_method || !render_method(ob, work, rd->opaque))
+			bufput(ob, work->data, work->size);
+		break;
+	}
+
+	case SD_AST_ENTITY:
+		if (cb->entity)
+			cb->entity(ob, &text, rd->opaque);
+		else
+			bufput(ob, text.data, text.size);
+		break;
+
+	case SD_AST_TEXT:
+		if (cb->normal_text)
+			cb->normal_text(ob, &text, rd->opaque);
+		else
+			bufput(ob, text.data, text.size);
+		break;
+	}
+
+	return 0;
+}
+
+/**********************
+ * EXPORTED FUNCTIONS *
+ **********************/
+
+void
+sdast_reset(struct sd_ast *ast)
+{
+	ast->nodes->size = 0;
+	ast->strings->size = 0;
+	ast->work_nodes->size = 0;
+	ast->work_links->size = 0;
+}
+
+/* sdast_finish • flattens the tree referenced from `ob` into `nodes`,
+ * in document order, so that every parent precedes its children */
+int
+sdast_finish(struct sd_ast *ast, const struct buf *ob)
+{
+	struct buf *remap;
+	size_t node_count = ast->work_nodes->size / sizeof(struct sd_ast_node);
+	int32_t id, *new_id;
+
+	ast->nodes->size = 0;
+
+	if (!ob || ob->size != AST_REF_DIGITS + 1 || ob->data[0] != AST_REF_MARK)
+		return -1;
+
+	id = ast_get_ref(ob->data);
+	if (id < 0 || (size_t)id >= node_count)
+		return -1;
+
+	remap = bufnew(64);
+	bufgrow(remap, node_count * sizeof(int32_t));
+	bufgrow(ast->nodes, node_count * sizeof(struct sd_ast_node));
+	new_id = (int32_t *)remap->data;
+
+	while (id >= 0) {
+		struct sd_ast_node node = *AST_NODE(ast, id);
+
+		new_id[id] = (int32_t)(ast->nodes->size / sizeof(node));
+		if (node.parent >= 0)
+			node.parent = new_id[node.parent];
+
+		bufput(ast->nodes, &node, sizeof(node));
+
+		/* depth first: children, then siblings, then back up */
+		if (AST_LINK(ast, id)->first_child >= 0) {
+			id = AST_LINK(ast, id)->first_child;
+			continue;
+		}
+
+		while (id >= 0 && AST_LINK(ast, id)->next_sibling < 0)
+			id = AST_NODE(ast, id)->parent;
+
+		if (id >= 0)
+			id = AST_LINK(ast, id)->next_sibling;
+	}
+
+	bufrelease(remap);
+	return 0;
+}
+
+/* sdast_serialize • writes the finished tree in its compact form */
+void
+sdast_serialize(struct buf *ob, const struct sd_ast *ast)
+{
+	const struct sd_ast_node *nodes = (const struct sd_ast_node *)ast->nodes->data;
+	size_t i, node_count = ast->nodes->size / sizeof(struct sd_ast_node);
+	uint32_t *child_count;
+	struct buf *counts;
+
+	BUFPUTSL(ob, "sd");
+	bufputc(ob, AST_SERIAL_VERSION);
+
+	if (!node_count)
+		return;
+
+	counts = bufnew(64);
+	bufgrow(counts, node_count * sizeof(uint32_t));
+	child_count = (uint32_t *)counts->data;
+	memset(child_count, 0x0, node_count * sizeof(uint32_t));
+
+	for (i = 0; i < node_count; ++i) {
+		if (nodes[i].parent >= 0)
+			child_count[nodes[i].parent]++;
+	}
+
+	for (i = 0; i < node_count; ++i) {
+		const struct sd_ast_node *node = &nodes[i];
+		uint8_t fields = ast_type_fields[node->type];
+		uint8_t head = node->type;
+
+		if (node->text.size) head |= AST_HAS_TEXT;
+		if (node->link.size) head |= AST_HAS_LINK;
+		if (node->title.size) head |= AST_HAS_TITLE;
+
+		bufputc(ob, head);
+
+		if (fields & AST_USES_FLAGS)
+			ast_put_varint(ob, node->flags);
+
+		if (fields & AST_USES_VALUE)
+			ast_put_varint(ob, (uint32_t)node->value);
+
+		if (node->text.size) ast_put_slice(ob, ast, node->text);
+		if (node->link.size) ast_put_slice(ob, ast, node->link);
+		if (node->title.size) ast_put_slice(ob, ast, node->title);
+
+		if (!(fields & AST_IS_LEAF))
+			ast_put_varint(ob, child_count[i]);
+	}
+
+	bufrelease(counts);
+}
+
+/* sdast_render • expands a serialized tree through `callbacks`, the same
+ * way sd_markdown_render would have called them; returns 0 on success
+ * and -1 when the data is not a valid serialized tree */
+int
+sdast_render(struct buf *ob, const uint8_t *data, size_t size, const struct sd_callbacks *callbacks, void *opaque)
+{
+	struct ast_reader rd;
+	size_t i;
+	int ret = 0;
+
+	if (size < 3 || data[0] != 's' || data[1] != 'd' || data[2] != AST_SERIAL_VERSION)
+		return -1;
+
+	memset(&rd, 0x0, sizeof(rd));
+	rd.data = data;
+	rd.size = size;
+	rd.pos = 3;
+	rd.cb = callbacks;
+	rd.opaque = opaque;
+	rd.link_work = bufnew(64);
+	stack_init(&rd.work_bufs, 8);
+
+	if (callbacks->doc_header)
+		callbacks->doc_header(ob, opaque);
+
+	if (rd.pos < rd.size) {
+		if ((rd.data[rd.pos] & AST_TYPE_MASK) != SD_AST_DOCUMENT ||
+			ast_render_node(ob, &rd, 0) < 0 || rd.pos != rd.size)
+			ret = -1;
+	}
+
+	if (callbacks->doc_footer)
+		callbacks->doc_footer(ob, opaque);
+
+	for (i = 0; i < rd.work_bufs.size; ++i)
+		bufrelease(rd.work_bufs.item[i]);
+
+	stack_free(&rd.work_bufs);
+	bufrelease(rd.link_work);
+	return ret;
+}
+
+void
+sdast_free(struct sd_ast *ast)
+{
+	bufrelease(ast->nodes);
+	bufrelease(ast->strings);
+	bufrelease(ast->work_nodes);
+	bufrelease(ast->work_links);
+	memset(ast, 0x0, sizeof(struct sd_ast));
+}
+
+void
+sdast_renderer(struct sd_callbacks *callbacks, struct sd_ast *ast, unsigned int render_flags)
+{
+	static const struct sd_callbacks cb_default = {
+		ast_blockcode,
+		ast_blockquote,
+		ast_blockspoiler,
+		ast_blockhtml,
+		ast_header,
+		ast_hrule,
+		ast_list,
+		ast_listitem,
+		ast_paragraph,
+		ast_table,
+		ast_table_row,
+		ast_table_cell,
+
+		ast_autolink,
+		ast_codespan,
+		ast_spoilerspan,
+		ast_double_emphasis,
+		ast_emphasis,
+		ast_image,
+		ast_linebreak,
+		ast_link,
+		ast_raw_html,
+		ast_triple_emphasis,
+		ast_strikethrough,
+		ast_superscript,
+
+		ast_entity,
+		ast_normal_text,
+
+		NULL,
+		ast_doc_footer,
+
+		NULL,
+		NULL,
+	};
+
+	memset(ast, 0x0, sizeof(struct sd_ast));
+	ast->flags = render_flags;
+	ast->nodes = bufnew(64 * sizeof(struct sd_ast_node));
+	ast->strings = bufnew(1024);
+	ast->work_nodes = bufnew(64 * sizeof(struct sd_ast_node));
+	ast->work_links = bufnew(64 * sizeof(struct ast_link));
+
+	memcpy(callbacks, &cb_default, sizeof(struct sd_callbacks));
+
+	/* the same callbacks are left out as in the HTML renderer */
+	if (render_flags & HTML_SKIP_IMAGES)
+		callbacks->image = NULL;
+
+	if (render_flags & HTML_SKIP_LINKS) {
+		callbacks->link = NULL;
+		callbacks->autolink = NULL;
+	}
+
+	if (render_flags & HTML_SKIP_HTML || render_flags & HTML_ESCAPE)
+		callbacks->blockhtml = NULL;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2015, reddit inc.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef UPSKIRT_AST_H
+#define UPSKIRT_AST_H
+
+#include "markdown.h"
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum sd_ast_type {
+	SD_AST_DOCUMENT = 0,
+
+	/* blocks */
+	SD_AST_BLOCKCODE,
+	SD_AST_BLOCKQUOTE,
+	SD_AST_BLOCKSPOILER,
+	SD_AST_BLOCKHTML,
+	SD_AST_HEADER,
+	SD_AST_HRULE,
+	SD_AST_LIST,
+	SD_AST_LISTITEM,
+	SD_AST_PARAGRAPH,
+	SD_AST_TABLE,
+	SD_AST_TABLE_HEADER,
+	SD_AST_TABLE_BODY,
+	SD_AST_TABLE_ROW,
+	SD_AST_TABLE_CELL,
+
+	/* spans */
+	SD_AST_AUTOLINK,
+	SD_AST_CODESPAN,
+	SD_AST_SPOILERSPAN,
+	SD_AST_DOUBLE_EMPHASIS,
+	SD_AST_EMPHASIS,
+	SD_AST_IMAGE,
+	SD_AST_LINEBREAK,
+	SD_AST_LINK,
+	SD_AST_RAW_HTML,
+	SD_AST_TRIPLE_EMPHASIS,
+	SD_AST_STRIKETHROUGH,
+	SD_AST_SUPERSCRIPT,
+
+	/* low level */
+	SD_AST_ENTITY,
+	SD_AST_TEXT,
+
+	SD_AST_TYPE_COUNT
+};
+
+/* sd_ast_slice: a string in the tree's string pool */
+struct sd_ast_slice {
+	uint32_t offset;
+	uint32_t size;
+};
+
+/* sd_ast_node: one node of the flattened tree.
+ *
+ * `flags` carries the list, table cell and autolink flags handed to the
+ * matching callback, and `value` the header level or cell column span.
+ * `text` holds literal contents (text, code, raw html, entity, image alt),
+ * `link` the target of links and images, and `title` their title or the
+ * language of a code block. Container contents are child nodes. */
+struct sd_ast_node {
+	uint16_t type;
+	uint16_t flags;
+	int32_t parent;
+	int32_t value;
+	struct sd_ast_slice text;
+	struct sd_ast_slice link;
+	struct sd_ast_slice title;
+};
+
+struct sd_ast {
+	struct buf *nodes;		/* struct sd_ast_node, in document order */
+	struct buf *strings;	/* string pool the slices point into */
+
+	/* private */
+	struct buf *work_nodes;
+	struct buf *work_links;
+	unsigned int flags;
+};
+
+extern const char *sdast_type_names[SD_AST_TYPE_COUNT];
+
+extern void
+sdast_renderer(struct sd_callbacks *callbacks, struct sd_ast *ast, unsigned int render_flags);
+
+extern void
+sdast_reset(struct sd_ast *ast);
+
+extern int
+sdast_finish(struct sd_ast *ast, const struct buf *ob);
+
+extern void
+sdast_free(struct sd_ast *ast);
+
+extern void
+sdast_serialize(struct buf *ob, const struct sd_ast *ast);
+
+extern int
+sdast_render(struct buf *ob, const uint8_t *data, size_t size, const struct sd_callbacks *callbacks, void *opaque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
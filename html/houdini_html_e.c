@@ -3,6 +3,7 @@
 #include <string.h>
 
 #include "houdini.h"
+#include "scan.h"
 
 #define ESCAPE_GROW_FACTOR(x) (((x) * 12) / 10) /* this is very scientific, yes */
 
@@ -56,8 +57,7 @@ houdini_escape_html0(struct buf *ob, const uint8_t *src, size_t size, int secure
 
 	while (i < size) {
 		org = i;
-		while (i < size && (esc = HTML_ESCAPE_TABLE[src[i]]) == 0)
-			i++;
+		i += sd_scan->html_escape(src + i, size - i);
 
 		if (i > org)
 			bufput(ob, src + org, i - org);
@@ -66,6 +66,8 @@ houdini_escape_html0(struct buf *ob, const uint8_t *src, size_t size, int secure
 		if (i >= size)
 			break;
 
+		esc = HTML_ESCAPE_TABLE[src[i]];
+
 		/* The forward slash is only escaped in secure mode */
 		if (src[i] == '/' && !secure) {
 			bufputc(ob, '/');
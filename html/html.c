@@ -21,7 +21,6 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <stdbool.h>
 
 #include "houdini.h"
@@ -55,12 +54,113 @@ sdhtml_is_tag(const uint8_t *tag_data, size_t tag_size, const char *tagname)
 	if (i == tag_size)
 		return HTML_TAG_NONE;
 
-	if (isspace(tag_data[i]) || tag_data[i] == '>')
+	if (sd_isspace(tag_data[i]) || tag_data[i] == '>')
 		return closed ? HTML_TAG_CLOSE : HTML_TAG_OPEN;
 
 	return HTML_TAG_NONE;
 }
 
+/* whitelist_hash • FNV-1a over the lowercased name */
+static unsigned int
+whitelist_hash(unsigned int seed, const uint8_t *name, size_t size)
+{
+	unsigned int hash = 2166136261u ^ seed;
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		hash = (hash ^ sd_tolower(name[i])) * 16777619u;
+
+	return hash ^ (hash >> 15);
+}
+
+/* whitelist_compile • looks for the smallest table and a seed that hash
+ * every name into its own slot */
+static void
+whitelist_compile(struct sdhtml_whitelist *table, char **names)
+{
+	unsigned int mask, seed, slot;
+	size_t count = 0, i;
+
+	memset(table, 0x0, sizeof(struct sdhtml_whitelist));
+	table->names = names;
+
+	if (!names)
+		return;
+
+	while (names[count])
+		count++;
+
+	if (!count)
+		return;
+
+	/* keep the table at most half full */
+	mask = 1;
+	while (mask + 1 < count * 2)
+		mask = (mask << 1) | 1;
+
+	for (; mask < SDHTML_WHITELIST_SLOTS; mask = (mask << 1) | 1) {
+		for (seed = 0; seed < 4096; ++seed) {
+			memset(table->slots, 0x0, sizeof(table->slots));
+
+			for (i = 0; i < count; ++i) {
+				slot = whitelist_hash(seed, (const uint8_t *)names[i], strlen(names[i])) & mask;
+				if (table->slots[slot])
+					break;
+				table->slots[slot] = names[i];
+			}
+
+			if (i == count) {
+				table->seed = seed;
+				table->mask = mask;
+				return;
+			}
+		}
+	}
+
+	memset(table->slots, 0x0, sizeof(table->slots));
+}
+
+/* whitelist_find • returns the whitelisted name matching name, or NULL */
+static const char *
+whitelist_find(const struct sdhtml_whitelist *table, const uint8_t *name, size_t size, int ignore_case)
+{
+	const char *match;
+	size_t i;
+
+	if (!size || !table->names)
+		return NULL;
+
+	if (table->mask) {
+		match = table->slots[whitelist_hash(table->seed, name, size) & table->mask];
+		if (!match || strlen(match) != size)
+			return NULL;
+
+		if (ignore_case ? strncasecmp(match, (const char *)name, size) : memcmp(match, name, size))
+			return NULL;
+
+		return match;
+	}
+
+	for (i = 0; table->names[i]; ++i) {
+		match = table->names[i];
+		if (strlen(match) == size &&
+			(ignore_case ? strncasecmp(match, (const char *)name, size) : memcmp(match, name, size)) == 0)
+			return match;
+	}
+
+	return NULL;
+}
+
+void
+sdhtml_set_whitelists(struct html_renderopt *options, char **elements, char **attributes)
+{
+	options->html_element_whitelist = elements;
+	options->html_attr_whitelist = attributes;
+
+	whitelist_compile(&options->element_table, elements);
+	whitelist_compile(&options->attr_table, attributes);
+}
+
 static inline void escape_html(struct buf *ob, const uint8_t *source, size_t length)
 {
 	houdini_escape_html0(ob, source, length, 0);
@@ -120,19 +220,20 @@ rndr_autolink(struct buf *ob, const struct buf *link, enum mkd_autolink type, vo
 static void
 rndr_blockcode(struct buf *ob, const struct buf *text, const struct buf *lang, void *opaque)
 {
-	if (ob->size) bufputc(ob, '\n');
+	struct html_renderopt *options = opaque;
+	if (ob->size > options->container_start) bufputc(ob, '\n');
 
 	if (lang && lang->size) {
 		size_t i, cls;
 		BUFPUTSL(ob, "<pre><code class=\"md-code-language-");
 
 		for (i = 0, cls = 0; i < lang->size; ++i, ++cls) {
-			while (i < lang->size && isspace(lang->data[i]))
+			while (i < lang->size && sd_isspace(lang->data[i]))
 				i++;
 
 			if (i < lang->size) {
 				size_t org = i;
-				while (i < lang->size && !isspace(lang->data[i]))
+				while (i < lang->size && !sd_isspace(lang->data[i]))
 					i++;
 
 				if (lang->data[org] == '.')
@@ -156,7 +257,8 @@ rndr_blockcode(struct buf *ob, const struct buf *text, const struct buf *lang, v
 static void
 rndr_blockquote(struct buf *ob, const struct buf *text, void *opaque)
 {
-	if (ob->size) bufputc(ob, '\n');
+	struct html_renderopt *options = opaque;
+	if (ob->size > options->container_start) bufputc(ob, '\n');
 	BUFPUTSL(ob, "<blockquote>\n");
 	if (text) bufput(ob, text->data, text->size);
 	BUFPUTSL(ob, "</blockquote>\n");
@@ -165,12 +267,146 @@ rndr_blockquote(struct buf *ob, const struct buf *text, void *opaque)
 static void
 rndr_blockspoiler(struct buf *ob, const struct buf *text, void *opaque)
 {
-	if (ob->size) bufputc(ob, '\n');
+	struct html_renderopt *options = opaque;
+	if (ob->size > options->container_start) bufputc(ob, '\n');
 	BUFPUTSL(ob, "<blockquote class=\"md-spoiler-text\">\n");
 	if (text) bufput(ob, text->data, text->size);
 	BUFPUTSL(ob, "</blockquote>\n");
 }
 
+/* tablecell_open • writes the opening tag of a table cell */
+static void
+tablecell_open(struct buf *ob, int flags, int col_span)
+{
+	if (flags & MKD_TABLE_HEADER) {
+		BUFPUTSL(ob, "<th");
+	} else {
+		BUFPUTSL(ob, "<td");
+	}
+
+	if (col_span > 1) {
+		bufprintf(ob, " colspan=\"%d\" ", col_span);
+	}
+
+	switch (flags & MKD_TABLE_ALIGNMASK) {
+	case MKD_TABLE_ALIGN_CENTER:
+		BUFPUTSL(ob, " align=\"center\">");
+		break;
+
+	case MKD_TABLE_ALIGN_L:
+		BUFPUTSL(ob, " align=\"left\">");
+		break;
+
+	case MKD_TABLE_ALIGN_R:
+		BUFPUTSL(ob, " align=\"right\">");
+		break;
+
+	default:
+		BUFPUTSL(ob, ">");
+	}
+}
+
+static size_t
+rndr_container_open(struct buf *ob, enum mkd_container type, int flags, void *opaque)
+{
+	struct html_renderopt *options = opaque;
+	size_t mark = options->container_start;
+
+	switch (type) {
+	case MKD_CONTAINER_BLOCKQUOTE:
+		if (ob->size > mark) bufputc(ob, '\n');
+		BUFPUTSL(ob, "<blockquote>\n");
+		break;
+
+	case MKD_CONTAINER_BLOCKSPOILER:
+		if (ob->size > mark) bufputc(ob, '\n');
+		BUFPUTSL(ob, "<blockquote class=\"md-spoiler-text\">\n");
+		break;
+
+	case MKD_CONTAINER_LIST:
+		if (ob->size > mark) bufputc(ob, '\n');
+		bufput(ob, flags & MKD_LIST_ORDERED ? "<ol>\n" : "<ul>\n", 5);
+		break;
+
+	case MKD_CONTAINER_LISTITEM:
+		BUFPUTSL(ob, "<li>");
+		break;
+
+	case MKD_CONTAINER_TABLE:
+		if (ob->size > mark) bufputc(ob, '\n');
+		BUFPUTSL(ob, "<table>");
+		break;
+
+	case MKD_CONTAINER_TABLE_HEADER:
+		BUFPUTSL(ob, "<thead>\n");
+		break;
+
+	case MKD_CONTAINER_TABLE_BODY:
+		BUFPUTSL(ob, "<tbody>\n");
+		break;
+
+	case MKD_CONTAINER_TABLE_ROW:
+		BUFPUTSL(ob, "<tr>\n");
+		break;
+
+	case MKD_CONTAINER_TABLE_CELL:
+		tablecell_open(ob, flags, 0);
+		break;
+	}
+
+	options->container_start = ob->size;
+	return mark;
+}
+
+static void
+rndr_container_close(struct buf *ob, enum mkd_container type, int flags, size_t mark, void *opaque)
+{
+	struct html_renderopt *options = opaque;
+
+	switch (type) {
+	case MKD_CONTAINER_BLOCKQUOTE:
+	case MKD_CONTAINER_BLOCKSPOILER:
+		BUFPUTSL(ob, "</blockquote>\n");
+		break;
+
+	case MKD_CONTAINER_LIST:
+		bufput(ob, flags & MKD_LIST_ORDERED ? "</ol>\n" : "</ul>\n", 6);
+		break;
+
+	case MKD_CONTAINER_LISTITEM:
+		while (ob->size > options->container_start && ob->data[ob->size - 1] == '\n')
+			ob->size--;
+		BUFPUTSL(ob, "</li>\n");
+		break;
+
+	case MKD_CONTAINER_TABLE:
+		BUFPUTSL(ob, "</table>\n");
+		break;
+
+	case MKD_CONTAINER_TABLE_HEADER:
+		BUFPUTSL(ob, "</thead>");
+		break;
+
+	case MKD_CONTAINER_TABLE_BODY:
+		BUFPUTSL(ob, "</tbody>");
+		break;
+
+	case MKD_CONTAINER_TABLE_ROW:
+		BUFPUTSL(ob, "</tr>\n");
+		break;
+
+	case MKD_CONTAINER_TABLE_CELL:
+		if (flags & MKD_TABLE_HEADER) {
+			BUFPUTSL(ob, "</th>\n");
+		} else {
+			BUFPUTSL(ob, "</td>\n");
+		}
+		break;
+	}
+
+	options->container_start = mark;
+}
+
 static int
 rndr_codespan(struct buf *ob, const struct buf *text, void *opaque)
 {
@@ -241,7 +477,7 @@ rndr_header(struct buf *ob, const struct buf *text, int level, void *opaque)
 {
 	struct html_renderopt *options = opaque;
 
-	if (ob->size)
+	if (ob->size > options->container_start)
 		bufputc(ob, '\n');
 
 	if (options->flags & HTML_TOC) {
@@ -292,7 +528,8 @@ rndr_link(struct buf *ob, const struct buf *link, const struct buf *title, const
 static void
 rndr_list(struct buf *ob, const struct buf *text, int flags, void *opaque)
 {
-	if (ob->size) bufputc(ob, '\n');
+	struct html_renderopt *options = opaque;
+	if (ob->size > options->container_start) bufputc(ob, '\n');
 	bufput(ob, flags & MKD_LIST_ORDERED ? "<ol>\n" : "<ul>\n", 5);
 	if (text) bufput(ob, text->data, text->size);
 	bufput(ob, flags & MKD_LIST_ORDERED ? "</ol>\n" : "</ul>\n", 6);
@@ -318,12 +555,12 @@ rndr_paragraph(struct buf *ob, const struct buf *text, void *opaque)
 	struct html_renderopt *options = opaque;
 	size_t i = 0;
 
-	if (ob->size) bufputc(ob, '\n');
+	if (ob->size > options->container_start) bufputc(ob, '\n');
 
 	if (!text || !text->size)
 		return;
 
-	while (i < text->size && isspace(text->data[i])) i++;
+	while (i < text->size && sd_isspace(text->data[i])) i++;
 
 	if (i == text->size)
 		return;
@@ -358,6 +595,7 @@ rndr_paragraph(struct buf *ob, const struct buf *text, void *opaque)
 static void
 rndr_raw_block(struct buf *ob, const struct buf *text, void *opaque)
 {
+	struct html_renderopt *options = opaque;
 	size_t org, sz;
 	if (!text) return;
 	sz = text->size;
@@ -365,7 +603,7 @@ rndr_raw_block(struct buf *ob, const struct buf *text, void *opaque)
 	org = 0;
 	while (org < sz && text->data[org] == '\n') org++;
 	if (org >= sz) return;
-	if (ob->size) bufputc(ob, '\n');
+	if (ob->size > options->container_start) bufputc(ob, '\n');
 	bufput(ob, text->data + org, sz - org);
 	bufputc(ob, '\n');
 }
@@ -384,7 +622,7 @@ static void
 rndr_hrule(struct buf *ob, void *opaque)
 {
 	struct html_renderopt *options = opaque;
-	if (ob->size) bufputc(ob, '\n');
+	if (ob->size > options->container_start) bufputc(ob, '\n');
 	bufputs(ob, USE_XHTML(options) ? "<hr/>\n" : "<hr>\n");
 }
 
@@ -409,14 +647,19 @@ rndr_image(struct buf *ob, const struct buf *link, const struct buf *title, cons
 	return 1;
 }
 
+/* rndr_html_tag • writes a whitelisted tag with only its whitelisted,
+ * quoted attributes. Attribute names and values are slices of the tag
+ * text: a name runs from the last reset to the '=', a value between
+ * the quotes. Spaces outside quotes, quotes before an '=' and a second
+ * '=' start over. */
 static void
 rndr_html_tag(struct buf *ob, const struct buf *text, void *opaque,
-             char* tagname, char** whitelist, int tagtype)
+             const char* tagname, const struct sdhtml_whitelist *whitelist, int tagtype)
 {
-    size_t i, x, z, in_str = 0, seen_equals = 0, done = 0, done_attr = 0, reset = 0;
-    struct buf *attr;
-    struct buf *value;
-    char c;
+    const uint8_t *data = text->data;
+    size_t i, attr_beg, attr_end = 0, value_beg = 0;
+    int seen_equals = 0;
+    uint8_t in_str = 0, c;
 
     bufputc(ob, '<');
 
@@ -429,91 +672,49 @@ rndr_html_tag(struct buf *ob, const struct buf *text, void *opaque,
 
     bufputs(ob, tagname);
     i = 1 + strlen(tagname);
-
-    attr = bufnew(16);
-    value = bufnew(16);
-
-    for(; i < text->size && !done; i++) {
-        c = text->data[i];
-        done = 0;
-        reset = 0;
-        done_attr = 0;
-
-        switch(c) {
-            case '>':
-                done = 1;
-                break;
-            case '\'':
-            case '"':
-                if(!seen_equals) {
-                    reset = 1;
-                } else if(!in_str) {
-                    in_str = c;
-                } else if(in_str == c) {
-                    in_str = 0;
-                    done_attr = 1;
-                } else {
-                    bufputc(value, c);
-                }
-                break;
-            case ' ':
-                if (in_str) {
-                    bufputc(value, ' ');
-                } else {
-                    reset = 1;
-                }
-                break;
-            case '=':
-                if(seen_equals) {
-                    reset = 1;
-                    break;
-                }
-                seen_equals = 1;
-                break;
-            default:
-                if(seen_equals && in_str || !seen_equals) {
-                    bufputc(seen_equals ? value : attr, c);
-                }
-                break;
-        }
-
-        if(done_attr) {
-            int valid = 0;
-            for(z = 0; whitelist[z]; z++) {
-                if(strlen(whitelist[z]) != attr->size) {
-                    continue;
-                }
-                for(x = 0; x < attr->size; x++) {
-                    if(tolower(whitelist[z][x]) != tolower(attr->data[x])) {
-                        break;
-                    }
-                }
-                if(x == attr->size) {
-                    valid = 1;
-                    break;
+    attr_beg = i;
+
+    for(; i < text->size; i++) {
+        c = data[i];
+
+        if(c == '>')
+            break;
+
+        if(c == '\'' || c == '"') {
+            if(!seen_equals) {
+                attr_beg = i + 1;
+            } else if(!in_str) {
+                in_str = c;
+                value_beg = i + 1;
+            } else if(in_str == c) {
+                if(i > value_beg && whitelist_find(whitelist, data + attr_beg, attr_end - attr_beg, 1)) {
+                    bufputc(ob, ' ');
+                    escape_html(ob, data + attr_beg, attr_end - attr_beg);
+                    bufputs(ob, "=\"");
+                    escape_html(ob, data + value_beg, i - value_beg);
+                    bufputc(ob, '"');
                 }
+                seen_equals = 0;
+                in_str = 0;
+                attr_beg = i + 1;
             }
-            if(valid && value->size && attr->size) {
-                bufputc(ob, ' ');
-                escape_html(ob, attr->data, attr->size);
-                bufputs(ob, "=\"");
-                escape_html(ob, value->data, value->size);
-                bufputc(ob, '"');
+        } else if(c == ' ') {
+            if(!in_str) {
+                seen_equals = 0;
+                attr_beg = i + 1;
+            }
+        } else if(c == '=') {
+            if(seen_equals) {
+                seen_equals = 0;
+                in_str = 0;
+                attr_beg = i + 1;
+            } else {
+                seen_equals = 1;
+                attr_end = i;
             }
-            reset = 1;
-        }
-
-        if(reset) {
-            seen_equals = 0;
-            in_str = 0;
-            bufreset(attr);
-            bufreset(value);
         }
     }
 
-    bufrelease(attr);
-    bufrelease(value);
-
     bufputc(ob, '>');
 }
 
@@ -521,20 +722,28 @@ static int
 rndr_raw_html(struct buf *ob, const struct buf *text, void *opaque)
 {
     struct html_renderopt *options = opaque;
-    char** whitelist = options->html_element_whitelist;
-    int i, tagtype;
+    const char *tagname;
+    size_t i, name;
+    int tagtype;
 
     /* Items on the whitelist ignore all other flags and just output */
-    if (((options->flags & HTML_ALLOW_ELEMENT_WHITELIST) != 0) && whitelist) {
-        for (i = 0; whitelist[i]; i++) {
-            tagtype = sdhtml_is_tag(text->data, text->size, whitelist[i]);
-            if (tagtype != HTML_TAG_NONE) {
-                rndr_html_tag(ob, text, opaque,
-                              whitelist[i],
-                              options->html_attr_whitelist,
-                              tagtype);
-                return 1;
-            }
+    if (((options->flags & HTML_ALLOW_ELEMENT_WHITELIST) != 0) &&
+        text->size >= 3 && text->data[0] == '<') {
+        i = 1;
+        tagtype = HTML_TAG_OPEN;
+        if (text->data[i] == '/') {
+            tagtype = HTML_TAG_CLOSE;
+            i++;
+        }
+
+        name = i;
+        while (i < text->size && text->data[i] != '>' && !sd_isspace(text->data[i]))
+            i++;
+
+        if (i < text->size &&
+            (tagname = whitelist_find(&options->element_table, text->data + name, i - name, 0)) != NULL) {
+            rndr_html_tag(ob, text, opaque, tagname, &options->attr_table, tagtype);
+            return 1;
         }
     }
 
@@ -567,7 +776,8 @@ rndr_raw_html(struct buf *ob, const struct buf *text, void *opaque)
 static void
 rndr_table(struct buf *ob, const struct buf *header, const struct buf *body, void *opaque)
 {
-	if (ob->size) bufputc(ob, '\n');
+	struct html_renderopt *options = opaque;
+	if (ob->size > options->container_start) bufputc(ob, '\n');
 	BUFPUTSL(ob, "<table><thead>\n");
 	if (header)
 		bufput(ob, header->data, header->size);
@@ -589,32 +799,7 @@ rndr_tablerow(struct buf *ob, const struct buf *text, void *opaque)
 static void
 rndr_tablecell(struct buf *ob, const struct buf *text, int flags, void *opaque, int col_span)
 {
-	if (flags & MKD_TABLE_HEADER) {
-		BUFPUTSL(ob, "<th");
-	} else {
-		BUFPUTSL(ob, "<td");
-	}
-
-	if (col_span > 1) {
-		bufprintf(ob, " colspan=\"%d\" ", col_span);
-	}
-
-	switch (flags & MKD_TABLE_ALIGNMASK) {
-	case MKD_TABLE_ALIGN_CENTER:
-		BUFPUTSL(ob, " align=\"center\">");
-		break;
-
-	case MKD_TABLE_ALIGN_L:
-		BUFPUTSL(ob, " align=\"left\">");
-		break;
-
-	case MKD_TABLE_ALIGN_R:
-		BUFPUTSL(ob, " align=\"right\">");
-		break;
-
-	default:
-		BUFPUTSL(ob, ">");
-	}
+	tablecell_open(ob, flags, col_span);
 
 	if (text)
 		bufput(ob, text->data, text->size);
@@ -751,6 +936,9 @@ sdhtml_toc_renderer(struct sd_callbacks *callbacks, struct html_renderopt *optio
 
 		NULL,
 		toc_finalize,
+
+		NULL,
+		NULL,
 	};
 
 	memset(options, 0x0, sizeof(struct html_renderopt));
@@ -794,6 +982,9 @@ sdhtml_renderer(struct sd_callbacks *callbacks, struct html_renderopt *options,
 
 		NULL,
 		reset_toc,
+
+		rndr_container_open,
+		rndr_container_close,
 	};
 
 	/* Prepare the options pointer */
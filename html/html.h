@@ -25,6 +25,17 @@
 extern "C" {
 #endif
 
+#define SDHTML_WHITELIST_SLOTS 64
+
+/* sdhtml_whitelist: a whitelist of tag or attribute names, hashed into
+ * slots without collisions when the whitelist is set */
+struct sdhtml_whitelist {
+	char **names;
+	const char *slots[SDHTML_WHITELIST_SLOTS];
+	unsigned int seed;
+	unsigned int mask;	/* 0 when no perfect hash was found */
+};
+
 struct html_renderopt {
 	struct {
 		int header_count;
@@ -39,8 +50,16 @@ struct html_renderopt {
 	char** html_element_whitelist;
 	char** html_attr_whitelist;
 
+	/* compiled by sdhtml_set_whitelists */
+	struct sdhtml_whitelist element_table;
+	struct sdhtml_whitelist attr_table;
+
 	/* extra callbacks */
 	void (*link_attributes)(struct buf *ob, const struct buf *url, void *self);
+
+	/* start of the content of the innermost container rendered in
+	 * place; a block written there is the first in its container */
+	size_t container_start;
 };
 
 typedef enum {
@@ -72,6 +91,9 @@ sdhtml_renderer(struct sd_callbacks *callbacks, struct html_renderopt *options_p
 extern void
 sdhtml_toc_renderer(struct sd_callbacks *callbacks, struct html_renderopt *options_ptr);
 
+extern void
+sdhtml_set_whitelists(struct html_renderopt *options, char **elements, char **attributes);
+
 extern void
 sdhtml_smartypants(struct buf *ob, const uint8_t *text, size_t size);
 
@@ -20,7 +20,6 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 
 #if defined(_WIN32)
 #define snprintf	_snprintf
@@ -80,7 +79,7 @@ static const uint8_t smartypants_cb_chars[] = {
 static inline int
 word_boundary(uint8_t c)
 {
-	return c == 0 || isspace(c) || ispunct(c);
+	return c == 0 || sd_isspace(c) || sd_ispunct(c);
 }
 
 static int
@@ -104,7 +103,7 @@ static size_t
 smartypants_cb__squote(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (size >= 2) {
-		uint8_t t1 = tolower(text[1]);
+		uint8_t t1 = sd_tolower(text[1]);
 
 		if (t1 == '\'') {
 			if (smartypants_quotes(ob, previous_char, size >= 3 ? text[2] : 0, 'd', &smrt->in_dquote))
@@ -118,7 +117,7 @@ smartypants_cb__squote(struct buf *ob, struct smartypants_data *smrt, uint8_t pr
 		}
 
 		if (size >= 3) {
-			uint8_t t2 = tolower(text[2]);
+			uint8_t t2 = sd_tolower(text[2]);
 
 			if (((t1 == 'r' && t2 == 'e') ||
 				(t1 == 'l' && t2 == 'l') ||
@@ -141,8 +140,8 @@ static size_t
 smartypants_cb__parens(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (size >= 3) {
-		uint8_t t1 = tolower(text[1]);
-		uint8_t t2 = tolower(text[2]);
+		uint8_t t1 = sd_tolower(text[1]);
+		uint8_t t2 = sd_tolower(text[2]);
 
 		if (t1 == 'c' && t2 == ')') {
 			BUFPUTSL(ob, "&copy;");
@@ -237,7 +236,7 @@ smartypants_cb__number(struct buf *ob, struct smartypants_data *smrt, uint8_t pr
 
 		if (text[0] == '1' && text[1] == '/' && text[2] == '4') {
 			if (size == 3 || word_boundary(text[3]) ||
-				(size >= 5 && tolower(text[3]) == 't' && tolower(text[4]) == 'h')) {
+				(size >= 5 && sd_tolower(text[3]) == 't' && sd_tolower(text[4]) == 'h')) {
 				BUFPUTSL(ob, "&frac14;");
 				return 2;
 			}
@@ -245,7 +244,7 @@ smartypants_cb__number(struct buf *ob, struct smartypants_data *smrt, uint8_t pr
 
 		if (text[0] == '3' && text[1] == '/' && text[2] == '4') {
 			if (size == 3 || word_boundary(text[3]) ||
-				(size >= 6 && tolower(text[3]) == 't' && tolower(text[4]) == 'h' && tolower(text[5]) == 's')) {
+				(size >= 6 && sd_tolower(text[3]) == 't' && sd_tolower(text[4]) == 'h' && sd_tolower(text[5]) == 's')) {
 				BUFPUTSL(ob, "&frac34;");
 				return 2;
 			}
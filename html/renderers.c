@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2015, reddit inc.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "renderers.h"
+
+const unsigned int snudown_default_md_flags =
+	MKDEXT_NO_INTRA_EMPHASIS |
+	MKDEXT_SUPERSCRIPT |
+	MKDEXT_AUTOLINK |
+	MKDEXT_STRIKETHROUGH |
+	MKDEXT_TABLES |
+	MKDEXT_FENCED_CODE;
+
+const unsigned int snudown_default_render_flags =
+	HTML_SKIP_HTML |
+	HTML_SKIP_IMAGES |
+	HTML_SAFELINK |
+	HTML_ESCAPE |
+	HTML_USE_XHTML;
+
+const unsigned int snudown_wiki_render_flags =
+	HTML_SKIP_HTML |
+	HTML_SAFELINK |
+	HTML_ALLOW_ELEMENT_WHITELIST |
+	HTML_ESCAPE |
+	HTML_USE_XHTML;
+
+static char* html_element_whitelist[] = {"tr", "th", "td", "table", "tbody", "thead", "tfoot", "caption", NULL};
+static char* html_attr_whitelist[] = {"colspan", "rowspan", "cellspacing", "cellpadding", "scope", NULL};
+
+static void
+snudown_link_attr(struct buf *ob, const struct buf *link, void *opaque)
+{
+	struct snudown_renderopt *options = opaque;
+
+	if (options->nofollow)
+		BUFPUTSL(ob, " rel=\"nofollow\"");
+
+	if (options->target != NULL) {
+		BUFPUTSL(ob, " target=\"");
+		bufputs(ob, options->target);
+		bufputc(ob, '\"');
+	}
+}
+
+unsigned int
+snudown_render_flags(int renderer)
+{
+	return (renderer == RENDERER_WIKI) ?
+		snudown_wiki_render_flags : snudown_default_render_flags;
+}
+
+struct sd_markdown *
+snudown_make_renderer(struct module_state *state, unsigned int render_flags,
+	unsigned int md_flags, int toc_renderer)
+{
+	if (toc_renderer) {
+		sdhtml_toc_renderer(&state->callbacks,
+			(struct html_renderopt *)&state->options);
+	} else {
+		sdhtml_renderer(&state->callbacks,
+			(struct html_renderopt *)&state->options,
+			render_flags);
+	}
+
+	state->options.html.link_attributes = &snudown_link_attr;
+	sdhtml_set_whitelists(&state->options.html, html_element_whitelist, html_attr_whitelist);
+
+	return sd_markdown_new(md_flags, 16, 64, &state->callbacks, &state->options);
+}
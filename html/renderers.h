@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2015, reddit inc.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef UPSKIRT_RENDERERS_H
+#define UPSKIRT_RENDERERS_H
+
+#include "markdown.h"
+#include "html.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The renderers behind snudown.markdown(). The Python module, the
+ * command-line renderer and the fuzzing harnesses all set up their
+ * parsers through here, so they parse and render with the same flags. */
+enum snudown_renderer_mode {
+	RENDERER_USERTEXT = 0,
+	RENDERER_WIKI,
+	RENDERER_COUNT
+};
+
+struct snudown_renderopt {
+	struct html_renderopt html;
+	int nofollow;
+	const char *target;
+};
+
+struct module_state {
+	struct sd_callbacks callbacks;
+	struct snudown_renderopt options;
+};
+
+extern const unsigned int snudown_default_md_flags;
+extern const unsigned int snudown_default_render_flags;
+extern const unsigned int snudown_wiki_render_flags;
+
+/* snudown_render_flags • the HTML flags of a renderer mode */
+extern unsigned int
+snudown_render_flags(int renderer);
+
+/* snudown_make_renderer • sets up state as a renderer with the given
+ * flags, or as its table of contents renderer, and returns a parser
+ * rendering through it, or NULL when out of memory */
+extern struct sd_markdown *
+snudown_make_renderer(struct module_state *state, unsigned int render_flags,
+	unsigned int md_flags, int toc_renderer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
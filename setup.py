@@ -30,11 +30,50 @@ with open('snudown.c', 'r') as f:
 assert version
 
 
+# Profile-guided builds: SNUDOWN_PGO=generate builds an instrumented
+# extension that writes profiles to SNUDOWN_PGO_DIR when it exits, and
+# SNUDOWN_PGO=use builds with those profiles. Both builds have to use the
+# same --build-temp, since profiles are matched by object path. `make pgo`
+# runs the whole cycle. Only gcc is supported: clang reads its profiles
+# only after they are merged with llvm-profdata, which this doesn't run.
+def is_gcc(compiler):
+    if compiler.compiler_type != 'unix':
+        return False
+    try:
+        version = subprocess.check_output(compiler.compiler[:1] + ['--version'],
+                                          stderr=subprocess.STDOUT).decode('utf-8', 'replace')
+    except (OSError, subprocess.CalledProcessError):
+        return False
+    return 'clang' not in version and 'Free Software Foundation' in version
+
+
+def pgo_flags(compiler):
+    mode = os.environ.get('SNUDOWN_PGO')
+    if not mode:
+        return []
+    if not is_gcc(compiler):
+        raise Exception("SNUDOWN_PGO needs gcc")
+
+    profile_dir = os.path.abspath(os.environ.get('SNUDOWN_PGO_DIR', 'build/pgo/profile'))
+    if mode == 'generate':
+        return ['-fprofile-generate=%s' % profile_dir, '-fprofile-update=atomic']
+    if mode == 'use':
+        return ['-fprofile-use=%s' % profile_dir, '-fprofile-correction', '-Wno-missing-profile']
+    raise Exception("SNUDOWN_PGO must be `generate` or `use`")
+
+
 class GPerfingBuildExt(build_ext):
     def run(self):
         process_gperf_file("src/html_entities.gperf", "src/html_entities.h")
         build_ext.run(self)
 
+    def build_extensions(self):
+        flags = pgo_flags(self.compiler)
+        for ext in self.extensions:
+            ext.extra_compile_args = (ext.extra_compile_args or []) + flags
+            ext.extra_link_args = (ext.extra_link_args or []) + flags
+        build_ext.build_extensions(self)
+
 setup(
     name='snudown',
     version=version,
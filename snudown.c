@@ -3,22 +3,14 @@
 
 #include "markdown.h"
 #include "html.h"
+#include "renderers.h"
 #include "autolink.h"
+#include "ast.h"
+#include "cache.h"
+#include "scan.h"
 
 #define SNUDOWN_VERSION "1.7.0"
 
-enum snudown_renderer_mode {
-	RENDERER_USERTEXT = 0,
-	RENDERER_WIKI,
-	RENDERER_COUNT
-};
-
-struct snudown_renderopt {
-	struct html_renderopt html;
-	int nofollow;
-	const char *target;
-};
-
 struct snudown_renderer {
 	struct sd_markdown* main_renderer;
 	struct sd_markdown* toc_renderer;
@@ -26,108 +18,314 @@ struct snudown_renderer {
 	struct module_state* toc_state;
 };
 
-struct module_state {
+struct ast_state {
 	struct sd_callbacks callbacks;
-	struct snudown_renderopt options;
+	struct sd_ast ast;
+	struct sd_markdown *renderer;
+	struct buf *scratch;
 };
 
-static struct snudown_renderer sundown[RENDERER_COUNT];
+#define SNUDOWN_MAX_THREADS 16
 
-static char* html_element_whitelist[] = {"tr", "th", "td", "table", "tbody", "thead", "tfoot", "caption", NULL};
-static char* html_attr_whitelist[] = {"colspan", "rowspan", "cellspacing", "cellpadding", "scope", NULL};
+/* parallel_state: extra main renderers for rendering one document on
+ * several threads; renderers[0] is the renderer's own main_renderer */
+struct parallel_state {
+	struct sd_markdown *renderers[SNUDOWN_MAX_THREADS];
+	struct module_state states[SNUDOWN_MAX_THREADS];
+	size_t count;
+};
+
+static struct snudown_renderer sundown[RENDERER_COUNT];
+static struct parallel_state parallel_states[RENDERER_COUNT];
+static struct ast_state ast_states[RENDERER_COUNT];
 
 static struct module_state usertext_toc_state;
 static struct module_state wiki_toc_state;
 static struct module_state usertext_state;
 static struct module_state wiki_state;
 
+enum snudown_extract_kind {
+	EXTRACT_LINK = 0,
+	EXTRACT_IMAGE,
+	EXTRACT_SUBREDDIT,
+	EXTRACT_USERNAME,
+	EXTRACT_COUNT
+};
+
+struct extract_item {
+	enum snudown_extract_kind kind;
+	size_t source;
+	size_t str_offset;
+	size_t str_size;
+};
+
+/* extract_state: link targets found by the extraction renderer; the
+ * targets themselves are packed one after another into `strings`.
+ * Plain text is copied unescaped into `scratch` only so autolinks
+ * can rewind over it. */
+struct extract_state {
+	struct buf *items;
+	struct buf *strings;
+	struct buf *scratch;
+};
+
+static struct sd_cache *render_cache;
+static unsigned long render_cache_hits, render_cache_misses;
+
+static struct sd_markdown *extract_renderer;
+static struct extract_state extract_state;
+static PyObject *extract_keys[EXTRACT_COUNT];
+
 /* The module doc strings */
 PyDoc_STRVAR(snudown_module__doc__, "When does the narwhal bacon? At Sundown.");
 PyDoc_STRVAR(snudown_md__doc__, "Render a Markdown document");
+PyDoc_STRVAR(snudown_ast__doc__, "Parse a Markdown document into a flat list of nodes");
+PyDoc_STRVAR(snudown_serialize__doc__, "Parse a Markdown document into its compact cacheable form");
+PyDoc_STRVAR(snudown_expand__doc__, "Render a document serialized by snudown.serialize");
+PyDoc_STRVAR(snudown_document__doc__, "Document(nofollow=0, target=None, renderer=RENDERER_USERTEXT)\n\n"
+	"A Markdown document that is rendered repeatedly as it is edited; each\n"
+	"render only re-parses the blocks changed since the previous one");
+PyDoc_STRVAR(snudown_document_render__doc__, "Render the current version of the document");
+PyDoc_STRVAR(snudown_enable_cache__doc__, "enable_cache(path, size=64MB)\n\n"
+	"Cache rendered documents in a memory-mapped file shared by every process\n"
+	"that enables the same path");
+PyDoc_STRVAR(snudown_disable_cache__doc__, "Stop using the shared render cache");
+PyDoc_STRVAR(snudown_cache_stats__doc__, "cache_stats() -> (hits, misses)\n\n"
+	"How many renders of this process the shared render cache served and\n"
+	"missed since it was last enabled");
+PyDoc_STRVAR(snudown_output_size__doc__, "output_size(data)\n\n"
+	"The rendered size the current CPU level's scan kernel counts for data");
+PyDoc_STRVAR(snudown_extract__doc__, "Extract links, images, subreddits and usernames from a Markdown document");
+
+/********************
+ * EXTRACT RENDERER *
+ ********************/
+
+static void
+extract_record(struct extract_state *state, enum snudown_extract_kind kind, const struct buf *target)
+{
+	struct extract_item item;
+
+	if (!target || !target->size)
+		return;
+
+	item.kind = kind;
+	item.source = sd_markdown_link_source(extract_renderer);
+	item.str_offset = state->strings->size;
+	item.str_size = target->size;
+
+	bufput(state->strings, target->data, target->size);
+	bufput(state->items, &item, sizeof(item));
+}
+
+/* extract_link_kind • autolinked /r/ and /u/ references always carry a
+ * leading slash by the time they reach the link callback */
+static enum snudown_extract_kind
+extract_link_kind(const struct buf *link)
+{
+	if (link->size > 3 && link->data[0] == '/' && link->data[2] == '/') {
+		if (link->data[1] == 'r' || link->data[1] == 'R')
+			return EXTRACT_SUBREDDIT;
+		if (link->data[1] == 'u' || link->data[1] == 'U')
+			return EXTRACT_USERNAME;
+	}
+
+	return EXTRACT_LINK;
+}
+
+static int
+extract_link(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *content, void *opaque)
+{
+	if (link)
+		extract_record(opaque, extract_link_kind(link), link);
+	return 1;
+}
+
+static int
+extract_autolink(struct buf *ob, const struct buf *link, enum mkd_autolink type, void *opaque)
+{
+	extract_record(opaque, EXTRACT_LINK, link);
+	return 1;
+}
+
+static int
+extract_image(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *alt, void *opaque)
+{
+	extract_record(opaque, EXTRACT_IMAGE, link);
+	return 1;
+}
+
+/* spans must report success so their contents aren't scanned twice */
+static int
+extract_span(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return 1;
+}
 
-static const unsigned int snudown_default_md_flags =
-	MKDEXT_NO_INTRA_EMPHASIS |
-	MKDEXT_SUPERSCRIPT |
-	MKDEXT_AUTOLINK |
-	MKDEXT_STRIKETHROUGH |
-	MKDEXT_TABLES |
-	MKDEXT_FENCED_CODE;
-
-static const unsigned int snudown_default_render_flags =
-	HTML_SKIP_HTML |
-	HTML_SKIP_IMAGES |
-	HTML_SAFELINK |
-	HTML_ESCAPE |
-	HTML_USE_XHTML;
-
-static const unsigned int snudown_wiki_render_flags =
-	HTML_SKIP_HTML |
-	HTML_SAFELINK |
-	HTML_ALLOW_ELEMENT_WHITELIST |
-	HTML_ESCAPE |
-	HTML_USE_XHTML;
+static void
+extract_table_row(struct buf *ob, const struct buf *text, void *opaque)
+{
+}
 
 static void
-snudown_link_attr(struct buf *ob, const struct buf *link, void *opaque)
+extract_table_cell(struct buf *ob, const struct buf *text, int flags, void *opaque, int col_span)
 {
-	struct snudown_renderopt *options = opaque;
+}
 
-	if (options->nofollow)
-		BUFPUTSL(ob, " rel=\"nofollow\"");
+/* may_link • whether text has one of the bytes every target needs: a '['
+ * for links and images, ':' or '@' for autolinks, '/' for mentions, or
+ * the start of "www."; text without any has nothing to extract */
+static int
+may_link(const uint8_t *data, size_t size)
+{
+	static uint8_t link_bytes[256];
+	size_t i = 0;
 
-	if (options->target != NULL) {
-		BUFPUTSL(ob, " target=\"");
-		bufputs(ob, options->target);
-		bufputc(ob, '\"');
+	if (!link_bytes['[']) {
+		link_bytes['['] = link_bytes[':'] = link_bytes['@'] = link_bytes['/'] = 1;
+		link_bytes['w'] = 2;
+	}
+
+	for (;;) {
+		while (i < size && !link_bytes[data[i]])
+			i++;
+
+		if (i >= size)
+			return 0;
+
+		if (link_bytes[data[i]] == 1 ||
+			(i + 4 <= size && memcmp(data + i, "www.", 4) == 0))
+			return 1;
+
+		i++;
 	}
 }
 
-static struct sd_markdown* make_custom_renderer(struct module_state* state,
-												const unsigned int renderflags,
-												const unsigned int markdownflags,
-												int toc_renderer) {
-	if(toc_renderer) {
-		sdhtml_toc_renderer(&state->callbacks,
-			(struct html_renderopt *)&state->options);
-	} else {
-		sdhtml_renderer(&state->callbacks,
-			(struct html_renderopt *)&state->options,
-			renderflags);
+void init_extract_renderer(PyObject *module) {
+	static const char *kind_names[EXTRACT_COUNT] = {"links", "images", "subreddits", "usernames"};
+	size_t i;
+
+	static const struct sd_callbacks cb_extract = {
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		NULL,
+		extract_table_row,
+		extract_table_cell,
+
+		extract_autolink,
+		extract_span,
+		extract_span,
+		extract_span,
+		extract_span,
+		extract_image,
+		NULL,
+		extract_link,
+		NULL,
+		extract_span,
+		extract_span,
+		extract_span,
+
+		NULL,
+		NULL,
+
+		NULL,
+		NULL,
+
+		NULL,
+		NULL,
+	};
+
+	extract_state.items = bufnew(16 * sizeof(struct extract_item));
+	extract_state.strings = bufnew(256);
+	extract_state.scratch = bufnew(1024);
+	extract_renderer = sd_markdown_new(snudown_default_md_flags, 16, 64, &cb_extract, &extract_state);
+	sd_markdown_track_source(extract_renderer, 1);
+
+	/* the keys of every result, made once */
+	for (i = 0; i < EXTRACT_COUNT; ++i) {
+#if PY_MAJOR_VERSION >= 3
+		extract_keys[i] = PyUnicode_InternFromString(kind_names[i]);
+#else
+		extract_keys[i] = PyString_InternFromString(kind_names[i]);
+#endif
 	}
+}
 
-	state->options.html.link_attributes = &snudown_link_attr;
-	state->options.html.html_element_whitelist = html_element_whitelist;
-	state->options.html.html_attr_whitelist = html_attr_whitelist;
+static void make_ast_renderer(struct ast_state *state, const unsigned int renderflags, const unsigned int markdownflags) {
+	sdast_renderer(&state->callbacks, &state->ast, renderflags);
+	state->scratch = bufnew(1024);
+	state->renderer = sd_markdown_new(markdownflags, 16, 64, &state->callbacks, &state->ast);
+}
 
-	return sd_markdown_new(
-		markdownflags,
-		16,
-		64,
-		&state->callbacks,
-		&state->options
-	);
+void init_ast_renderers(PyObject *module) {
+	char name[64];
+	int i;
+
+	for (i = 0; i < SD_AST_TYPE_COUNT; ++i) {
+		snprintf(name, sizeof(name), "AST_%s", sdast_type_names[i]);
+		PyModule_AddIntConstant(module, name, i);
+	}
+
+	make_ast_renderer(&ast_states[RENDERER_USERTEXT], snudown_default_render_flags, snudown_default_md_flags);
+	make_ast_renderer(&ast_states[RENDERER_WIKI], snudown_wiki_render_flags, snudown_default_md_flags);
 }
 
 void init_default_renderer(PyObject *module) {
 	PyModule_AddIntConstant(module, "RENDERER_USERTEXT", RENDERER_USERTEXT);
-	sundown[RENDERER_USERTEXT].main_renderer = make_custom_renderer(&usertext_state, snudown_default_render_flags, snudown_default_md_flags, 0);
-	sundown[RENDERER_USERTEXT].toc_renderer = make_custom_renderer(&usertext_toc_state, snudown_default_render_flags, snudown_default_md_flags, 1);
+	sundown[RENDERER_USERTEXT].main_renderer = snudown_make_renderer(&usertext_state, snudown_default_render_flags, snudown_default_md_flags, 0);
+	sundown[RENDERER_USERTEXT].toc_renderer = snudown_make_renderer(&usertext_toc_state, snudown_default_render_flags, snudown_default_md_flags, 1);
 	sundown[RENDERER_USERTEXT].state = &usertext_state;
 	sundown[RENDERER_USERTEXT].toc_state = &usertext_toc_state;
 }
 
 void init_wiki_renderer(PyObject *module) {
 	PyModule_AddIntConstant(module, "RENDERER_WIKI", RENDERER_WIKI);
-	sundown[RENDERER_WIKI].main_renderer = make_custom_renderer(&wiki_state, snudown_wiki_render_flags, snudown_default_md_flags, 0);
-	sundown[RENDERER_WIKI].toc_renderer = make_custom_renderer(&wiki_toc_state, snudown_wiki_render_flags, snudown_default_md_flags, 1);
+	sundown[RENDERER_WIKI].main_renderer = snudown_make_renderer(&wiki_state, snudown_wiki_render_flags, snudown_default_md_flags, 0);
+	sundown[RENDERER_WIKI].toc_renderer = snudown_make_renderer(&wiki_toc_state, snudown_wiki_render_flags, snudown_default_md_flags, 1);
 	sundown[RENDERER_WIKI].state = &wiki_state;
 	sundown[RENDERER_WIKI].toc_state = &wiki_toc_state;
 }
 
+/* parallel_renderers • main renderers for `threads` threads, sharing the
+ * current options of the renderer's own */
+static struct sd_markdown **
+parallel_renderers(int renderer, size_t threads)
+{
+	struct parallel_state *parallel = &parallel_states[renderer];
+	unsigned int render_flags;
+	size_t i;
+
+	render_flags = snudown_render_flags(renderer);
+
+	parallel->renderers[0] = sundown[renderer].main_renderer;
+	if (parallel->count == 0)
+		parallel->count = 1;
+
+	for (; parallel->count < threads; parallel->count++) {
+		i = parallel->count;
+		parallel->renderers[i] = snudown_make_renderer(&parallel->states[i],
+			render_flags, snudown_default_md_flags, 0);
+		if (!parallel->renderers[i])
+			break;
+	}
+
+	for (i = 1; i < parallel->count; ++i)
+		parallel->states[i].options = sundown[renderer].state->options;
+
+	return parallel->renderers;
+}
+
 static PyObject *
 snudown_md(PyObject *self, PyObject *args, PyObject *kwargs)
 {
-	static char *kwlist[] = {"text", "nofollow", "target", "toc_id_prefix", "renderer", "enable_toc", NULL};
+	static char *kwlist[] = {"text", "nofollow", "target", "toc_id_prefix", "renderer", "enable_toc", "threads", NULL};
 
 	struct buf ib, *ob;
 	PyObject *py_result;
@@ -138,17 +336,25 @@ snudown_md(PyObject *self, PyObject *args, PyObject *kwargs)
 	int nofollow = 0;
 	char* target = NULL;
 	char* toc_id_prefix = NULL;
+	int threads = 1;
 	unsigned int flags;
+	struct sd_cache_key cache_key;
+	int cache_hit = 0;
 
 	memset(&ib, 0x0, sizeof(struct buf));
 
 	/* Parse arguments */
-	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|izzii", kwlist,
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|izziii", kwlist,
 				&ib.data, &ib.size, &nofollow,
-				&target, &toc_id_prefix, &renderer, &enable_toc)) {
+				&target, &toc_id_prefix, &renderer, &enable_toc, &threads)) {
 		return NULL;
 	}
 
+	if (threads < 1)
+		threads = 1;
+	if (threads > SNUDOWN_MAX_THREADS)
+		threads = SNUDOWN_MAX_THREADS;
+
 	if (renderer < 0 || renderer >= RENDERER_COUNT) {
 		PyErr_SetString(PyExc_ValueError, "Invalid renderer");
 		return NULL;
@@ -163,9 +369,27 @@ snudown_md(PyObject *self, PyObject *args, PyObject *kwargs)
 	/* Output buffer */
 	ob = bufnew(128);
 
+	/* the output depends on the text, the options and the version */
+	if (render_cache) {
+		struct buf *key_options = bufnew(64);
+
+		bufprintf(key_options, "%s%c%d%c%d%c%d%c%s%c%s", SNUDOWN_VERSION, 0,
+			renderer, 0, enable_toc, 0, nofollow, 0,
+			target ? target : "", 0, toc_id_prefix ? toc_id_prefix : "");
+		sdcache_key(&cache_key, render_cache, key_options->data, key_options->size,
+			ib.data, ib.size);
+		bufrelease(key_options);
+
+		cache_hit = sdcache_get(render_cache, &cache_key, ob);
+		if (cache_hit)
+			render_cache_hits++;
+		else
+			render_cache_misses++;
+	}
+
 	flags = options->html.flags;
 
-	if (enable_toc) {
+	if (enable_toc && !cache_hit) {
 		_snudown.toc_state->options.html.toc_id_prefix = toc_id_prefix;
 		sd_markdown_render(ob, ib.data, ib.size, _snudown.toc_renderer);
 		_snudown.toc_state->options.html.toc_id_prefix = NULL;
@@ -176,24 +400,449 @@ snudown_md(PyObject *self, PyObject *args, PyObject *kwargs)
 	options->html.toc_id_prefix = toc_id_prefix;
 
 	/* do the magic */
-	sd_markdown_render(ob, ib.data, ib.size, _snudown.main_renderer);
+	if (cache_hit) {
+		/* served from the shared cache */
+	} else if (threads > 1) {
+		struct sd_markdown **renderers = parallel_renderers(renderer, threads);
+		size_t count = parallel_states[renderer].count;
+
+		sd_markdown_render_parallel(ob, ib.data, ib.size, renderers,
+			count < (size_t)threads ? count : (size_t)threads);
+	} else {
+		sd_markdown_render(ob, ib.data, ib.size, _snudown.main_renderer);
+	}
 
 	options->html.toc_id_prefix = NULL;
 	options->html.flags = flags;
 
+	if (render_cache && !cache_hit)
+		sdcache_put(render_cache, &cache_key, ob->data, ob->size);
+
 	/* make a Python string */
 	result_text = "";
 	if (ob->data)
 		result_text = (const char*)ob->data;
-	py_result = Py_BuildValue("s#", result_text, (int)ob->size);
+	py_result = Py_BuildValue("s#", result_text, (Py_ssize_t)ob->size);
 
 	/* Cleanup */
 	bufrelease(ob);
 	return py_result;
 }
 
+/* snudown_document: a block cache plus the options it was rendered with */
+typedef struct {
+	PyObject_HEAD
+	struct sd_block_cache *cache;
+	int renderer;
+	int nofollow;
+	char *target;
+} snudown_document;
+
+static int
+snudown_document_init(snudown_document *self, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"nofollow", "target", "renderer", NULL};
+
+	int renderer = RENDERER_USERTEXT;
+	int nofollow = 0;
+	char *target = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|izi", kwlist,
+				&nofollow, &target, &renderer))
+		return -1;
+
+	if (renderer < 0 || renderer >= RENDERER_COUNT) {
+		PyErr_SetString(PyExc_ValueError, "Invalid renderer");
+		return -1;
+	}
+
+	sd_block_cache_free(self->cache);
+	free(self->target);
+
+	self->cache = sd_block_cache_new();
+	self->target = target ? strdup(target) : NULL;
+	self->renderer = renderer;
+	self->nofollow = nofollow;
+
+	if (!self->cache || (target && !self->target)) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+snudown_document_dealloc(snudown_document *self)
+{
+	sd_block_cache_free(self->cache);
+	free(self->target);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+snudown_document_render(snudown_document *self, PyObject *args)
+{
+	struct buf ib, *ob;
+	struct snudown_renderopt *options;
+	PyObject *py_result;
+
+	memset(&ib, 0x0, sizeof(struct buf));
+
+	if (!PyArg_ParseTuple(args, "s#", &ib.data, &ib.size))
+		return NULL;
+
+	if (!self->cache) {
+		PyErr_SetString(PyExc_ValueError, "Document is not initialized");
+		return NULL;
+	}
+
+	options = &sundown[self->renderer].state->options;
+	options->nofollow = self->nofollow;
+	options->target = self->target;
+
+	ob = bufnew(128);
+	sd_markdown_render_cached(ob, ib.data, ib.size, sundown[self->renderer].main_renderer, self->cache);
+
+	py_result = Py_BuildValue("s#", ob->data ? (const char *)ob->data : "", (Py_ssize_t)ob->size);
+
+	bufrelease(ob);
+	return py_result;
+}
+
+static PyMethodDef snudown_document_methods[] = {
+	{"render", (PyCFunction) snudown_document_render, METH_VARARGS, snudown_document_render__doc__},
+	{NULL, NULL, 0, NULL} /* Sentinel */
+};
+
+static PyTypeObject snudown_document_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"snudown.Document",				/* tp_name */
+	sizeof(snudown_document),		/* tp_basicsize */
+	0,								/* tp_itemsize */
+	(destructor)snudown_document_dealloc,	/* tp_dealloc */
+};
+
+static PyObject *
+ast_slice_value(struct sd_ast *ast, struct sd_ast_slice slice)
+{
+	if (!slice.size)
+		Py_RETURN_NONE;
+
+	return Py_BuildValue("s#", (const char *)ast->strings->data + slice.offset, (Py_ssize_t)slice.size);
+}
+
+static PyObject *
+snudown_ast(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"text", "renderer", "packed", NULL};
+
+	struct buf ib;
+	struct ast_state *state;
+	struct sd_ast_node *nodes;
+	size_t i, node_count;
+	int renderer = RENDERER_USERTEXT;
+	int packed = 0;
+	PyObject *py_result;
+
+	memset(&ib, 0x0, sizeof(struct buf));
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|ii", kwlist,
+				&ib.data, &ib.size, &renderer, &packed)) {
+		return NULL;
+	}
+
+	if (renderer < 0 || renderer >= RENDERER_COUNT) {
+		PyErr_SetString(PyExc_ValueError, "Invalid renderer");
+		return NULL;
+	}
+
+	state = &ast_states[renderer];
+	sdast_reset(&state->ast);
+	state->scratch->size = 0;
+
+	sd_markdown_render(state->scratch, ib.data, ib.size, state->renderer);
+
+	if (sdast_finish(&state->ast, state->scratch) < 0) {
+		PyErr_SetString(PyExc_RuntimeError, "Malformed document tree");
+		return NULL;
+	}
+
+	/* packed: the raw node array and its string pool */
+	if (packed) {
+#if PY_MAJOR_VERSION >= 3
+		return Py_BuildValue("(y#y#)",
+#else
+		return Py_BuildValue("(s#s#)",
+#endif
+			(const char *)state->ast.nodes->data, (Py_ssize_t)state->ast.nodes->size,
+			(const char *)state->ast.strings->data, (Py_ssize_t)state->ast.strings->size);
+	}
+
+	nodes = (struct sd_ast_node *)state->ast.nodes->data;
+	node_count = state->ast.nodes->size / sizeof(struct sd_ast_node);
+
+	py_result = PyList_New(node_count);
+	if (!py_result)
+		return NULL;
+
+	for (i = 0; i < node_count; ++i) {
+		PyObject *entry = Py_BuildValue("(iiiiNNN)",
+			(int)nodes[i].type, (int)nodes[i].flags,
+			(int)nodes[i].parent, (int)nodes[i].value,
+			ast_slice_value(&state->ast, nodes[i].text),
+			ast_slice_value(&state->ast, nodes[i].link),
+			ast_slice_value(&state->ast, nodes[i].title));
+
+		if (!entry) {
+			Py_DECREF(py_result);
+			return NULL;
+		}
+
+		PyList_SET_ITEM(py_result, i, entry);
+	}
+
+	return py_result;
+}
+
+static PyObject *
+snudown_serialize(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"text", "renderer", NULL};
+
+	struct buf ib, *ob;
+	struct ast_state *state;
+	int renderer = RENDERER_USERTEXT;
+	PyObject *py_result;
+
+	memset(&ib, 0x0, sizeof(struct buf));
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|i", kwlist,
+				&ib.data, &ib.size, &renderer)) {
+		return NULL;
+	}
+
+	if (renderer < 0 || renderer >= RENDERER_COUNT) {
+		PyErr_SetString(PyExc_ValueError, "Invalid renderer");
+		return NULL;
+	}
+
+	state = &ast_states[renderer];
+	sdast_reset(&state->ast);
+	state->scratch->size = 0;
+
+	sd_markdown_render(state->scratch, ib.data, ib.size, state->renderer);
+
+	if (sdast_finish(&state->ast, state->scratch) < 0) {
+		PyErr_SetString(PyExc_RuntimeError, "Malformed document tree");
+		return NULL;
+	}
+
+	/* the renderer goes first, expansion needs the matching options */
+	ob = bufnew(128);
+	bufputc(ob, renderer);
+	sdast_serialize(ob, &state->ast);
+
+#if PY_MAJOR_VERSION >= 3
+	py_result = Py_BuildValue("y#", (const char *)ob->data, (Py_ssize_t)ob->size);
+#else
+	py_result = Py_BuildValue("s#", (const char *)ob->data, (Py_ssize_t)ob->size);
+#endif
+
+	bufrelease(ob);
+	return py_result;
+}
+
+static PyObject *
+snudown_expand(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"data", "nofollow", "target", NULL};
+
+	struct buf ib, *ob;
+	PyObject *py_result;
+	const char* result_text;
+	struct snudown_renderer _snudown;
+	struct snudown_renderopt *options;
+	int nofollow = 0;
+	char* target = NULL;
+	int renderer, err;
+
+	memset(&ib, 0x0, sizeof(struct buf));
+
+#if PY_MAJOR_VERSION >= 3
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y#|iz", kwlist,
+#else
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|iz", kwlist,
+#endif
+				&ib.data, &ib.size, &nofollow, &target)) {
+		return NULL;
+	}
+
+	if (ib.size < 1 || ib.data[0] >= RENDERER_COUNT) {
+		PyErr_SetString(PyExc_ValueError, "Invalid serialized document");
+		return NULL;
+	}
+
+	renderer = ib.data[0];
+	_snudown = sundown[renderer];
+
+	options = &(_snudown.state->options);
+	options->nofollow = nofollow;
+	options->target = target;
+
+	ob = bufnew(128);
+	err = sdast_render(ob, ib.data + 1, ib.size - 1, &_snudown.state->callbacks, options);
+
+	if (err < 0) {
+		bufrelease(ob);
+		PyErr_SetString(PyExc_ValueError, "Invalid serialized document");
+		return NULL;
+	}
+
+	result_text = "";
+	if (ob->data)
+		result_text = (const char*)ob->data;
+	py_result = Py_BuildValue("s#", result_text, (Py_ssize_t)ob->size);
+
+	bufrelease(ob);
+	return py_result;
+}
+
+static PyObject *
+snudown_extract(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"text", NULL};
+
+	struct buf ib;
+	struct extract_item *items;
+	size_t i, item_count;
+	PyObject *lists[EXTRACT_COUNT] = {NULL};
+	PyObject *py_result = NULL;
+
+	memset(&ib, 0x0, sizeof(struct buf));
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#", kwlist, &ib.data, &ib.size))
+		return NULL;
+
+	extract_state.items->size = 0;
+	extract_state.strings->size = 0;
+	extract_state.scratch->size = 0;
+
+	if (may_link(ib.data, ib.size))
+		sd_markdown_render(extract_state.scratch, ib.data, ib.size, extract_renderer);
+
+	items = (struct extract_item *)extract_state.items->data;
+	item_count = extract_state.items->size / sizeof(struct extract_item);
+
+	for (i = 0; i < EXTRACT_COUNT; ++i) {
+		if ((lists[i] = PyList_New(0)) == NULL)
+			goto cleanup;
+	}
+
+	for (i = 0; i < item_count; ++i) {
+		const uint8_t *target = extract_state.strings->data + items[i].str_offset;
+		Py_ssize_t offset = items[i].source == SD_NO_SOURCE ? -1 : (Py_ssize_t)items[i].source;
+		PyObject *entry;
+		int err;
+
+		entry = Py_BuildValue("(ns#)", offset, (const char *)target, (Py_ssize_t)items[i].str_size);
+		if (!entry)
+			goto cleanup;
+
+		err = PyList_Append(lists[items[i].kind], entry);
+		Py_DECREF(entry);
+		if (err < 0)
+			goto cleanup;
+	}
+
+	py_result = PyDict_New();
+	if (!py_result)
+		goto cleanup;
+
+	for (i = 0; i < EXTRACT_COUNT; ++i) {
+		if (PyDict_SetItem(py_result, extract_keys[i], lists[i]) < 0) {
+			Py_CLEAR(py_result);
+			break;
+		}
+	}
+
+cleanup:
+	for (i = 0; i < EXTRACT_COUNT; ++i)
+		Py_XDECREF(lists[i]);
+
+	return py_result;
+}
+
+static PyObject *
+snudown_enable_cache(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	static char *kwlist[] = {"path", "size", NULL};
+
+	const char *path;
+	Py_ssize_t size = 64 * 1024 * 1024;
+	struct sd_cache *cache;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|n", kwlist, &path, &size))
+		return NULL;
+
+	if (size < 0) {
+		PyErr_SetString(PyExc_ValueError, "Invalid cache size");
+		return NULL;
+	}
+
+	cache = sdcache_open(path, (size_t)size);
+	if (!cache)
+		return PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+
+	sdcache_close(render_cache);
+	render_cache = cache;
+	render_cache_hits = render_cache_misses = 0;
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+snudown_disable_cache(PyObject *self, PyObject *args)
+{
+	sdcache_close(render_cache);
+	render_cache = NULL;
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+snudown_cache_stats(PyObject *self, PyObject *args)
+{
+	return Py_BuildValue("(kk)", render_cache_hits, render_cache_misses);
+}
+
+static PyObject *
+snudown_output_size(PyObject *self, PyObject *args)
+{
+	struct buf ib;
+
+	memset(&ib, 0x0, sizeof(struct buf));
+
+#if PY_MAJOR_VERSION >= 3
+	if (!PyArg_ParseTuple(args, "y#", &ib.data, &ib.size))
+#else
+	if (!PyArg_ParseTuple(args, "s#", &ib.data, &ib.size))
+#endif
+		return NULL;
+
+	return PyLong_FromSize_t(sd_scan->output_size(ib.data, ib.size));
+}
+
 static PyMethodDef snudown_methods[] = {
 	{"markdown", (PyCFunction) snudown_md, METH_VARARGS | METH_KEYWORDS, snudown_md__doc__},
+	{"ast", (PyCFunction) snudown_ast, METH_VARARGS | METH_KEYWORDS, snudown_ast__doc__},
+	{"serialize", (PyCFunction) snudown_serialize, METH_VARARGS | METH_KEYWORDS, snudown_serialize__doc__},
+	{"expand", (PyCFunction) snudown_expand, METH_VARARGS | METH_KEYWORDS, snudown_expand__doc__},
+	{"extract", (PyCFunction) snudown_extract, METH_VARARGS | METH_KEYWORDS, snudown_extract__doc__},
+	{"enable_cache", (PyCFunction) snudown_enable_cache, METH_VARARGS | METH_KEYWORDS, snudown_enable_cache__doc__},
+	{"disable_cache", (PyCFunction) snudown_disable_cache, METH_NOARGS, snudown_disable_cache__doc__},
+	{"cache_stats", (PyCFunction) snudown_cache_stats, METH_NOARGS, snudown_cache_stats__doc__},
+	{"output_size", (PyCFunction) snudown_output_size, METH_VARARGS, snudown_output_size__doc__},
 	{NULL, NULL, 0, NULL} /* Sentinel */
 };
 
@@ -230,10 +879,26 @@ static PyMethodDef snudown_methods[] = {
 
 	init_default_renderer(module);
 	init_wiki_renderer(module);
+	init_extract_renderer(module);
+	init_ast_renderers(module);
+
+	snudown_document_type.tp_flags = Py_TPFLAGS_DEFAULT;
+	snudown_document_type.tp_doc = snudown_document__doc__;
+	snudown_document_type.tp_methods = snudown_document_methods;
+	snudown_document_type.tp_init = (initproc)snudown_document_init;
+	snudown_document_type.tp_new = PyType_GenericNew;
+
+	if (PyType_Ready(&snudown_document_type) == 0) {
+		Py_INCREF(&snudown_document_type);
+		PyModule_AddObject(module, "Document", (PyObject *)&snudown_document_type);
+	}
 
 	/* Version */
 	PyModule_AddStringConstant(module, "__version__", SNUDOWN_VERSION);
 
+	/* Scanning kernels in use, set by the renderers above */
+	PyModule_AddStringConstant(module, "CPU_LEVEL", sd_scan->name);
+
 #if PY_MAJOR_VERSION >= 3
     return module;
 #endif
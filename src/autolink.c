@@ -20,12 +20,23 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 
 #if defined(_WIN32)
 #define strncasecmp	_strnicmp
 #endif
 
+/* bits from the SD_CT_* enum in autolink.h; nothing past 0x7f is set */
+const uint16_t sd_ctype[256] = {
+	0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x004, 0x004, 0x004, 0x004, 0x004, 0x000, 0x000,
+	0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000, 0x000,
+	0x004, 0x008, 0x008, 0x008, 0x008, 0x008, 0x008, 0x008, 0x008, 0x008, 0x008, 0x088, 0x008, 0x0d8, 0x088, 0x048,
+	0x1f2, 0x1f2, 0x1f2, 0x1f2, 0x1f2, 0x1f2, 0x1f2, 0x1f2, 0x1f2, 0x1f2, 0x008, 0x008, 0x008, 0x008, 0x008, 0x008,
+	0x008, 0x1f1, 0x1f1, 0x1f1, 0x1f1, 0x1f1, 0x1f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1,
+	0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x008, 0x008, 0x008, 0x008, 0x0e8,
+	0x008, 0x1f1, 0x1f1, 0x1f1, 0x1f1, 0x1f1, 0x1f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1,
+	0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x0f1, 0x008, 0x008, 0x008, 0x008, 0x000,
+};
+
 int
 sd_autolink_issafe(const uint8_t *link, size_t link_len)
 {
@@ -43,24 +54,19 @@ sd_autolink_issafe(const uint8_t *link, size_t link_len)
 
 		if (link_len > len &&
 			strncasecmp((char *)link, valid_uris[i], len) == 0 &&
-			(isalnum(link[len]) || link[len] == '#' || link[len] == '/' || link[len] == '?'))
+			(sd_isalnum(link[len]) || link[len] == '#' || link[len] == '/' || link[len] == '?'))
 			return 1;
 	}
 
 	return 0;
 }
 
+/* autolink_delim • trims trailing punctuation off a link; the link
+ * cannot contain '<', scan_link() and the e-mail scan stop before it */
 static size_t
 autolink_delim(uint8_t *data, size_t link_end, size_t max_rewind, size_t size)
 {
 	uint8_t cclose, copen = 0;
-	size_t i;
-
-	for (i = 0; i < link_end; ++i)
-		if (data[i] == '<') {
-			link_end = i;
-			break;
-		}
 
 	while (link_end > 0) {
 		uint8_t c = data[link_end - 1];
@@ -74,7 +80,7 @@ autolink_delim(uint8_t *data, size_t link_end, size_t max_rewind, size_t size)
 		else if (c == ';') {
 			size_t new_end = link_end - 2;
 
-			while (new_end > 0 && isalpha(data[new_end]))
+			while (new_end > 0 && sd_isalpha(data[new_end]))
 				new_end--;
 
 			if (new_end < link_end - 2 && data[new_end] == '&')
@@ -171,7 +177,7 @@ check_reddit_autolink_prefix(
 		 * A better implementation might try to rewind over bytes with the 8th bit set, try
 		 * to decode them to a valid codepoint, then do a unicode-aware check on the codepoint.
 		 */
-		else if (ispunct(boundary) || isspace(boundary))
+		else if (sd_isclass(boundary, SD_CT_PUNCT | SD_CT_SPACE))
 			return 1;
 		else
 			return 0;
@@ -188,30 +194,32 @@ check_reddit_autolink_prefix(
 	return 1;
 }
 
+/* scan_link • checks the domain starting at `data + domain` and returns
+ * the end of the link, at the first whitespace or '<' after it, or 0 if
+ * the domain is not valid. Both are found in the same pass. */
 static size_t
-check_domain(uint8_t *data, size_t size, int allow_short)
+scan_link(uint8_t *data, size_t domain, size_t size, int allow_short)
 {
 	size_t i, np = 0;
 
-	if (!isalnum(data[0]))
+	if (!sd_isalnum(data[domain]))
 		return 0;
 
-	for (i = 1; i < size - 1; ++i) {
+	for (i = domain + 1; i < size - 1; ++i) {
 		if (data[i] == '.') np++;
-		else if (!isalnum(data[i]) && data[i] != '-') break;
+		else if (!sd_isclass(data[i], SD_CT_DOMAIN)) break;
 	}
 
-	if (allow_short) {
-		/* We don't need a valid domain in the strict sense (with
-		 * least one dot; so just make sure it's composed of valid
-		 * domain characters and return the length of the the valid
-		 * sequence. */
-		return i;
-	} else {
-		/* a valid domain needs to have at least a dot.
-		 * that's as far as we get */
-		return np ? i : 0;
-	}
+	/* Short domains don't need to be valid in the strict sense, just
+	 * composed of valid domain characters. Otherwise, a valid domain
+	 * needs to have at least a dot; that's as far as we get */
+	if (!allow_short && np == 0)
+		return 0;
+
+	while (i < size && !sd_isspace(data[i]) && data[i] != '<')
+		i++;
+
+	return i;
 }
 
 size_t
@@ -225,20 +233,17 @@ sd_autolink__www(
 {
 	size_t link_end;
 
-	if (max_rewind > 0 && !ispunct(data[-1]) && !isspace(data[-1]))
+	if (max_rewind > 0 && !sd_isclass(data[-1], SD_CT_PUNCT | SD_CT_SPACE))
 		return 0;
 
 	if (size < 4 || memcmp(data, "www.", strlen("www.")) != 0)
 		return 0;
 
-	link_end = check_domain(data, size, 0);
+	link_end = scan_link(data, 0, size, 0);
 
 	if (link_end == 0)
 		return 0;
 
-	while (link_end < size && !isspace(data[link_end]))
-		link_end++;
-
 	link_end = autolink_delim(data, link_end, max_rewind, size);
 
 	if (link_end == 0)
@@ -265,16 +270,8 @@ sd_autolink__email(
 	for (rewind = 0; rewind < max_rewind; ++rewind) {
 		uint8_t c = data[-rewind - 1];
 
-		if (c == 0)
+		if (!sd_isclass(c, SD_CT_EMAIL))
 			break;
-
-		if (isalnum(c))
-			continue;
-
-		if (strchr(".+-_", c) != NULL)
-			continue;
-
-		break;
 	}
 
 	if (rewind == 0)
@@ -283,11 +280,14 @@ sd_autolink__email(
 	for (link_end = 0; link_end < size; ++link_end) {
 		uint8_t c = data[link_end];
 
-		if (isalnum(c))
+		if (sd_isalnum(c))
 			continue;
 
-		if (c == '@')
-			nb++;
+		if (c == '@') {
+			/* an address has a single '@' */
+			if (nb++ > 0)
+				return 0;
+		}
 		else if (c == '.' && link_end < size - 1)
 			np++;
 		else if (c != '-' && c != '_')
@@ -317,31 +317,22 @@ sd_autolink__url(
 	size_t size,
 	unsigned int flags)
 {
-	size_t link_end, rewind = 0, domain_len;
+	size_t link_end, rewind = 0;
 
 	if (size < 4 || data[1] != '/' || data[2] != '/')
 		return 0;
 
-	while (rewind < max_rewind && isalpha(data[-rewind - 1]))
+	while (rewind < max_rewind && sd_isalpha(data[-rewind - 1]))
 		rewind++;
 
 	if (!sd_autolink_issafe(data - rewind, size + rewind))
 		return 0;
 
-	link_end = strlen("://");
-
-	domain_len = check_domain(
-		data + link_end,
-		size - link_end,
-		flags & SD_AUTOLINK_SHORT_DOMAINS);
+	link_end = scan_link(data, strlen("://"), size, flags & SD_AUTOLINK_SHORT_DOMAINS);
 
-	if (domain_len == 0)
+	if (link_end == 0)
 		return 0;
 
-	link_end += domain_len;
-	while (link_end < size && !isspace(data[link_end]))
-		link_end++;
-
 	link_end = autolink_delim(data, link_end, max_rewind, size);
 
 	if (link_end == 0)
@@ -405,14 +396,13 @@ sd_autolink__subreddit(
 				link_end += 2;  /* Jump over the 't:' */
 
 			/* the first character of a subreddit name must be a letter or digit */
-			if (!isalnum(data[link_end]))
+			if (!sd_isalnum(data[link_end]))
 				return 0;
 			link_end += 1;
 		}
 
 		/* consume valid characters ([A-Za-z0-9_]) until we run out */
-		while (link_end < size && (isalnum(data[link_end]) ||
-							data[link_end] == '_'))
+		while (link_end < size && sd_isclass(data[link_end], SD_CT_NAME))
 			link_end++;
 
 		/* valid subreddit names are between 3 and 21 characters, with
@@ -426,10 +416,7 @@ sd_autolink__subreddit(
 	} while ( link_end < size && (data[link_end] == '+' || (is_allminus && data[link_end] == '-')) && link_end++ );
 
 	if (link_end < size && data[link_end] == '/') {
-		while (link_end < size && (isalnum(data[link_end]) ||
-									data[link_end] == '_' ||
-									data[link_end] == '/' ||
-									data[link_end] == '-'))
+		while (link_end < size && sd_isclass(data[link_end], SD_CT_PATH))
 			link_end++;
 	}
 
@@ -466,15 +453,12 @@ sd_autolink__username(
 	link_end = strlen("/");
 
 	/* the first letter of a username must... well, be valid, we don't care otherwise */
-	if (!isalnum(data[link_end]) && data[link_end] != '_' && data[link_end] != '-')
+	if (!sd_isclass(data[link_end], SD_CT_NAME | SD_CT_DOMAIN))
 		return 0;
 	link_end += 1;
 
 	/* consume valid characters ([A-Za-z0-9_-/]) until we run out */
-	while (link_end < size && (isalnum(data[link_end]) ||
-								data[link_end] == '_' ||
-								data[link_end] == '/' ||
-								data[link_end] == '-'))
+	while (link_end < size && sd_isclass(data[link_end], SD_CT_PATH))
 		link_end++;
 
 	/* make the link */
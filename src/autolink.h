@@ -27,6 +27,34 @@ enum {
 	SD_AUTOLINK_SHORT_DOMAINS = (1 << 0),
 };
 
+/* Character classes shared by the autolinker and the parser. These are
+ * the "C" locale classes, so bytes with the high bit set are never
+ * letters, whatever locale the host process runs in. */
+enum {
+	SD_CT_ALPHA = (1 << 0),
+	SD_CT_DIGIT = (1 << 1),
+	SD_CT_SPACE = (1 << 2),		/* isspace() */
+	SD_CT_PUNCT = (1 << 3),		/* ispunct() */
+	SD_CT_DOMAIN = (1 << 4),	/* [A-Za-z0-9-] */
+	SD_CT_NAME = (1 << 5),		/* [A-Za-z0-9_], subreddit names */
+	SD_CT_PATH = (1 << 6),		/* [A-Za-z0-9_/-], usernames and subreddit paths */
+	SD_CT_EMAIL = (1 << 7),		/* [A-Za-z0-9.+_-], the local part of an address */
+	SD_CT_XDIGIT = (1 << 8),
+
+	SD_CT_ALNUM = SD_CT_ALPHA | SD_CT_DIGIT,
+};
+
+extern const uint16_t sd_ctype[256];
+
+#define sd_isclass(c, classes) (sd_ctype[(uint8_t)(c)] & (classes))
+#define sd_isalnum(c) sd_isclass(c, SD_CT_ALNUM)
+#define sd_isalpha(c) sd_isclass(c, SD_CT_ALPHA)
+#define sd_isdigit(c) sd_isclass(c, SD_CT_DIGIT)
+#define sd_isspace(c) sd_isclass(c, SD_CT_SPACE)
+#define sd_ispunct(c) sd_isclass(c, SD_CT_PUNCT)
+#define sd_isxdigit(c) sd_isclass(c, SD_CT_XDIGIT)
+#define sd_tolower(c) (sd_isalpha(c) ? (uint8_t)(c) | 0x20 : (uint8_t)(c))
+
 int
 sd_autolink_issafe(const uint8_t *link, size_t link_len);
 
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2015, reddit inc.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cache.h"
+#include "siphash.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "sdcache1"
+#define CACHE_HEADER_SIZE 64
+#define CACHE_PROBES 8
+#define CACHE_MIN_SIZE (64 * 1024)
+
+/* cache_header: the start of the file. `head` is the ring position of
+ * the next write; it only grows, and position / ring_size is the
+ * generation an entry was written in */
+struct cache_header {
+	char magic[8];
+	uint8_t key[SIP_HASH_KEY_LEN];
+	uint64_t slot_count;
+	uint64_t ring_size;
+	uint64_t head;
+};
+
+/* cache_slot: a hint pointing a key at a record; pos is the record's
+ * ring position plus one, 0 for an empty slot */
+struct cache_slot {
+	uint64_t key;
+	uint64_t pos;
+};
+
+/* cache_record: written in the ring ahead of the output */
+struct cache_record {
+	uint64_t key[2];
+	uint64_t size;
+	uint64_t check;
+};
+
+struct sd_cache {
+	uint8_t *map;
+	size_t map_size;
+	struct cache_header *header;
+	struct cache_slot *slots;
+	uint8_t *ring;
+};
+
+#define LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* cache_layout • splits a file of `size` bytes into slots and ring */
+static int
+cache_layout(size_t size, uint64_t *slot_count, uint64_t *ring_size)
+{
+	uint64_t slots = 1;
+
+	if (size < CACHE_MIN_SIZE)
+		return 0;
+
+	/* one slot for every kilobyte of ring */
+	while (slots * 2 * 1024 <= size)
+		slots *= 2;
+
+	*slot_count = slots;
+	*ring_size = (size - CACHE_HEADER_SIZE - slots * sizeof(struct cache_slot)) & ~(uint64_t)7;
+	return 1;
+}
+
+/* cache_valid • whether the file holds a cache laid out for its size */
+static int
+cache_valid(const struct cache_header *header, size_t size)
+{
+	uint64_t slot_count, ring_size;
+
+	return memcmp(header->magic, CACHE_MAGIC, 8) == 0 &&
+		cache_layout(size, &slot_count, &ring_size) &&
+		header->slot_count == slot_count && header->ring_size == ring_size;
+}
+
+static int
+cache_random_key(uint8_t *key)
+{
+	int fd = open("/dev/urandom", O_RDONLY);
+	ssize_t n;
+
+	if (fd < 0)
+		return 0;
+
+	n = read(fd, key, SIP_HASH_KEY_LEN);
+	close(fd);
+
+	return n == SIP_HASH_KEY_LEN;
+}
+
+struct sd_cache *
+sdcache_open(const char *path, size_t size)
+{
+	struct sd_cache *cache;
+	struct cache_header *header;
+	struct stat st;
+	uint8_t *map;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return NULL;
+
+	/* only setting up the file takes a lock */
+	if (flock(fd, LOCK_EX) < 0 || fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	if (st.st_size > 0)
+		size = (size_t)st.st_size;
+	else if (size < CACHE_MIN_SIZE || ftruncate(fd, size) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	header = (struct cache_header *)map;
+	if (!cache_valid(header, size)) {
+		uint64_t slot_count, ring_size;
+
+		if (!cache_layout(size, &slot_count, &ring_size) || !cache_random_key(header->key)) {
+			munmap(map, size);
+			close(fd);
+			return NULL;
+		}
+
+		memset(map + CACHE_HEADER_SIZE, 0x0, slot_count * sizeof(struct cache_slot));
+		header->slot_count = slot_count;
+		header->ring_size = ring_size;
+		header->head = 0;
+		memcpy(header->magic, CACHE_MAGIC, 8);
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	cache = malloc(sizeof(struct sd_cache));
+	if (!cache) {
+		munmap(map, size);
+		return NULL;
+	}
+
+	cache->map = map;
+	cache->map_size = size;
+	cache->header = header;
+	cache->slots = (struct cache_slot *)(map + CACHE_HEADER_SIZE);
+	cache->ring = map + CACHE_HEADER_SIZE + header->slot_count * sizeof(struct cache_slot);
+
+	return cache;
+}
+
+void
+sdcache_close(struct sd_cache *cache)
+{
+	if (!cache)
+		return;
+
+	munmap(cache->map, cache->map_size);
+	free(cache);
+}
+
+void
+sdcache_key(struct sd_cache_key *key, const struct sd_cache *cache,
+	const uint8_t *options, size_t options_size, const uint8_t *text, size_t text_size)
+{
+	uint8_t sip_key[SIP_HASH_KEY_LEN];
+	uint64_t options_hash;
+
+	/* the options select the key the text is hashed with */
+	options_hash = siphash(options, options_size, cache->header->key);
+
+	memcpy(sip_key, cache->header->key, SIP_HASH_KEY_LEN);
+	memcpy(sip_key, &options_hash, sizeof options_hash);
+	key->hash[0] = siphash(text, text_size, sip_key);
+
+	memcpy(sip_key, cache->header->key, SIP_HASH_KEY_LEN);
+	memcpy(sip_key + 8, &options_hash, sizeof options_hash);
+	key->hash[1] = siphash(text, text_size, sip_key);
+}
+
+/* cache_evicted • whether a later write may have overwritten the record at pos */
+static int
+cache_evicted(const struct sd_cache *cache, uint64_t pos)
+{
+	return LOAD(&cache->header->head) > pos + cache->header->ring_size;
+}
+
+int
+sdcache_get(struct sd_cache *cache, const struct sd_cache_key *key, struct buf *ob)
+{
+	uint64_t mask = cache->header->slot_count - 1;
+	uint64_t ring_size = cache->header->ring_size;
+	struct cache_record record;
+	struct cache_slot *slot;
+	uint64_t pos, offset;
+	size_t i, start = ob->size;
+
+	for (i = 0; i < CACHE_PROBES; ++i) {
+		slot = &cache->slots[(key->hash[0] + i) & mask];
+
+		if (LOAD(&slot->key) != key->hash[0] || (pos = LOAD(&slot->pos)) == 0)
+			continue;
+
+		pos--;
+		offset = pos % ring_size;
+		if (offset + sizeof record > ring_size || cache_evicted(cache, pos))
+			continue;
+
+		memcpy(&record, cache->ring + offset, sizeof record);
+		if (record.key[0] != key->hash[0] || record.key[1] != key->hash[1] ||
+			record.size > ring_size - offset - sizeof record)
+			continue;
+
+		bufput(ob, cache->ring + offset + sizeof record, record.size);
+
+		/* the copy only counts if nothing overwrote it meanwhile */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (ob->size == start + record.size && !cache_evicted(cache, pos) &&
+			siphash(ob->data + start, record.size, cache->header->key) == record.check)
+			return 1;
+
+		ob->size = start;
+	}
+
+	return 0;
+}
+
+void
+sdcache_put(struct sd_cache *cache, const struct sd_cache_key *key, const uint8_t *data, size_t size)
+{
+	uint64_t mask = cache->header->slot_count - 1;
+	uint64_t ring_size = cache->header->ring_size;
+	uint64_t head, pos, offset, need, oldest = UINT64_MAX, slot_pos;
+	struct cache_record record;
+	struct cache_slot *slot, *victim = NULL;
+	size_t i;
+
+	need = (sizeof record + size + 7) & ~(uint64_t)7;
+	if (need > ring_size / 4)
+		return;
+
+	/* reserve room in the ring, skipping the tail if the record would wrap */
+	head = LOAD(&cache->header->head);
+	do {
+		pos = head;
+		offset = pos % ring_size;
+		if (offset + need > ring_size)
+			pos += ring_size - offset;
+	} while (!__atomic_compare_exchange_n(&cache->header->head, &head, pos + need,
+		0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	offset = pos % ring_size;
+	record.key[0] = key->hash[0];
+	record.key[1] = key->hash[1];
+	record.size = size;
+	record.check = siphash(data, size, cache->header->key);
+
+	memcpy(cache->ring + offset, &record, sizeof record);
+	memcpy(cache->ring + offset + sizeof record, data, size);
+
+	/* take the slot of the same key, an empty or evicted one, or the oldest */
+	for (i = 0; i < CACHE_PROBES; ++i) {
+		slot = &cache->slots[(key->hash[0] + i) & mask];
+		slot_pos = LOAD(&slot->pos);
+
+		if (LOAD(&slot->key) == key->hash[0] || slot_pos == 0 ||
+			cache_evicted(cache, slot_pos - 1)) {
+			victim = slot;
+			break;
+		}
+
+		if (slot_pos < oldest) {
+			oldest = slot_pos;
+			victim = slot;
+		}
+	}
+
+	STORE(&victim->pos, 0);
+	STORE(&victim->key, key->hash[0]);
+	STORE(&victim->pos, pos + 1);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2015, reddit inc.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef UPSKIRT_CACHE_H
+#define UPSKIRT_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A render cache in a memory-mapped file, shared by every process that
+ * opens the same file. Entries are looked up without locks: the table
+ * only holds hints, and every hit is checked against the stored key and
+ * a hash of the stored output before it is returned. Outputs are written
+ * one after another into a ring, and a lap around the ring evicts the
+ * previous generation of entries. */
+struct sd_cache;
+
+struct sd_cache_key {
+	uint64_t hash[2];
+};
+
+extern struct sd_cache *
+sdcache_open(const char *path, size_t size);
+
+extern void
+sdcache_close(struct sd_cache *cache);
+
+extern void
+sdcache_key(struct sd_cache_key *key, const struct sd_cache *cache,
+	const uint8_t *options, size_t options_size, const uint8_t *text, size_t text_size);
+
+extern int
+sdcache_get(struct sd_cache *cache, const struct sd_cache_key *key, struct buf *ob);
+
+extern void
+sdcache_put(struct sd_cache *cache, const struct sd_cache_key *key, const uint8_t *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
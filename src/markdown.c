@@ -20,11 +20,12 @@
 #include "markdown.h"
 #include "stack.h"
 #include "siphash.h"
+#include "scan.h"
 
 #include <assert.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #if __GLIBC__ >= 2 && __GLIBC_MINOR >= 25
 #include <sys/random.h>
@@ -62,9 +63,22 @@ struct link_ref {
 	struct buf *label;
 	struct buf *title;
 
+	/* offset of the link in the document */
+	size_t source;
+
 	struct link_ref *next;
 };
 
+/* link_refs • the reference definitions of a document, chained into
+ * buckets by hash; the buckets start out in place and double in number
+ * whenever there are more than two definitions to a bucket */
+struct link_refs {
+	struct link_ref **bucket;
+	size_t size;
+	size_t count;
+	struct link_ref *initial[REF_TABLE_SIZE];
+};
+
 /* char_trigger: function pointer to render active chars */
 /*   returns the number of chars taken care of */
 /*   data is the pointer of the beginning of the span */
@@ -118,18 +132,196 @@ static char_trigger markdown_char_ptrs[] = {
 	&char_superscript,
 };
 
+/* a block tag and the offset of the top-level text past which it has
+ * no closing tag */
+#define HTML_UNCLOSED_TAGS 8
+
+struct html_unclosed {
+	const char *tag;
+	size_t from;
+};
+
+/* a '[' of the span being parsed and the offset of its matching ']'
+ * from it, or 0 if it has none */
+struct bracket {
+	size_t open;
+	size_t close;
+};
+
+/* what inline openers look for past them: a character that ends their
+ * construct, or a delimiter that can close emphasis, which is one not
+ * preceded by whitespace */
+enum span_closer {
+	CLOSER_STAR,
+	CLOSER_UNDERSCORE,
+	CLOSER_TILDE,
+	CLOSER_GT,
+	CLOSER_LT,
+	CLOSER_BRACKET,
+	CLOSER_PAREN,
+	CLOSER_BACKTICK,
+	CLOSER_BACKSLASH,
+	CLOSER_QUOTE,
+	CLOSER_DQUOTE,
+	CLOSER_EMPH_STAR,	/* '*' closing emph1 or emph3 */
+	CLOSER_EMPH_UNDERSCORE,	/* '_' closing emph3 */
+	CLOSER_EMPH1_UNDERSCORE,	/* '_' closing emph1, not within a word */
+	CLOSER_EMPH2_STAR,	/* "**" */
+	CLOSER_EMPH2_UNDERSCORE,	/* "__" */
+	CLOSER_EMPH2_TILDE,	/* "~~" */
+	CLOSER_EMPH2_GT,	/* ">>", which closes double emphasis too */
+	CLOSER_SPOILER,	/* "!<" */
+	CLOSER_COUNT
+};
+
+/* emph_scans • the '`' and '[' that find_emph_char stepped over in a
+ * span looking for one delimiter, each with the offset in the span it
+ * returned from there on, or 0; a scan reaching one of them would go the
+ * same way. An open-addressing table keyed on the offset + 1, with 0
+ * marking free slots */
+struct emph_scan {
+	size_t key;
+	size_t result;
+};
+
+struct emph_scans {
+	struct emph_scan *table;
+	size_t mask;
+	size_t count;
+};
+
+#define EMPH_SCAN_CHARS 5	/* '*', '_', '~', '>' and the '<' of spoilers */
+#define EMPH_SCAN_MEMO 8
+
+/* inline_span • the span parse_inline is working through, and what it
+ * has learned about it: the closing brackets and emphasis delimiters
+ * that every opener would otherwise look for to the end of the span */
+struct inline_span {
+	const uint8_t *data;
+	size_t size;
+
+	/* its struct bracket entries in sd_markdown.brackets, recorded for
+	 * every '[' from the first one char_link finds unmatched */
+	int brackets_done;
+	size_t brackets_from;
+	size_t bracket_next;
+
+	/* the first offsets from which char_link's scans for the end of an
+	 * inline link, and for the end of its title in '"' and in '\'', and
+	 * tag_length's scan for the end of an autolink ran off the span. A
+	 * scan only skips what follows a backslash, so it went through every
+	 * later offset after a '(', a ':', a space or a quote, and a scan
+	 * from there fails the same way */
+	size_t link_end_none;
+	size_t title_end_none[2];
+	size_t autolink_end_none;
+
+	/* for each enum span_closer, the furthest offset one was found at
+	 * and the offset past which there is none */
+	unsigned int closers_done;
+	size_t closer_next[CLOSER_COUNT];
+	size_t closer_none[CLOSER_COUNT];
+
+	/* for each delimiter find_emph_char looks for, where its scans
+	 * went; allocated once a scan steps over EMPH_SCAN_MEMO code spans
+	 * or links */
+	struct emph_scans emph_scans[EMPH_SCAN_CHARS];
+
+	/* for parse_emph1, parse_emph2 and parse_emph3 and each delimiter,
+	 * the offsets their loops searched from on the way to the end of
+	 * the span without finding a closer; result is unused */
+	struct emph_scans emph_fails[3][EMPH_SCAN_CHARS];
+};
+
+/* the block text being parsed; for '<' and for the ']', ')' and '`'
+ * that end the links and code spans find_emph_char steps over, the
+ * first one at or past the point the last search started from, or NULL;
+ * and where the scans for a '<' went from the code spans and links they
+ * stepped over. prefix_blockspoiler otherwise looks for them to the end
+ * of the text from every ">!". Text rewritten in place only moves down
+ * within the block being parsed, which later scans start past, so what
+ * they rely on still holds */
+enum {
+	BLOCK_SCAN_LT,
+	BLOCK_SCAN_BRACKET,
+	BLOCK_SCAN_PAREN,
+	BLOCK_SCAN_BACKTICK,
+	BLOCK_SCAN_CHARS
+};
+
+struct block_scan {
+	const uint8_t *start, *end;
+	const uint8_t *from[BLOCK_SCAN_CHARS];
+	const uint8_t *next[BLOCK_SCAN_CHARS];
+	struct emph_scans lt;
+};
+
 /* render • structure containing one particular render */
 struct sd_markdown {
 	struct sd_callbacks	cb;
 	void *opaque;
 
-	struct link_ref *refs[REF_TABLE_SIZE];
+	struct link_refs refs;
 	uint8_t active_char[256];
 	struct stack work_bufs[2];
 	unsigned int ext_flags;
 	size_t max_nesting;
 	size_t max_table_cols;
 	int in_link_body;
+
+	/* levels of nesting parsed or rendered in place, which count
+	 * against max_nesting like the work buffers of those that aren't */
+	size_t inplace_depth;
+
+	/* struct line_info for each line of the copied text, recorded by
+	 * the first pass; the block parser consults it while rendering
+	 * line_text, which is NULL when it renders anything else */
+	struct buf *lines;
+	const uint8_t *line_text;
+	size_t line_text_size;
+	size_t line_next;
+
+	/* column flags of the table being parsed; tables don't nest */
+	struct buf *table_cols;
+
+	/* what the innermost block text being parsed holds past a point */
+	struct block_scan spoiler_scan;
+
+	/* block tags with no closing tag past an offset of line_text */
+	struct html_unclosed html_unclosed[HTML_UNCLOSED_TAGS];
+	size_t html_unclosed_count;
+
+	/* the innermost parse_inline call, and the brackets of its span
+	 * and of the spans enclosing it */
+	struct inline_span *span;
+	struct buf *brackets;
+
+	/* the states the running find_emph_char scan stepped over, and
+	 * the offsets the running parse_emph loops searched from */
+	struct buf *emph_states;
+	struct buf *emph_loops;
+
+	/* when sources are tracked, the document offset of each byte of
+	 * line_text, and that of the link whose callback is running; the
+	 * text never outgrows a buffer, so offsets fit in 32 bits */
+	int track_source;
+	uint32_t *source;
+	size_t source_size, source_asize;
+	size_t link_source;
+
+	/* header callbacks made so far; the renderer may number them */
+	size_t header_count;
+
+	/* sd_scan->output_size() of the copied text, counted while copying */
+	size_t output_size;
+};
+
+/* one line of the copied text: the offset past its '\n' and the
+ * block_starts bits of its first non-space byte, narrowed down by
+ * checking the line itself */
+struct line_info {
+	size_t end;
+	uint8_t starts;
 };
 
 int sip_hash_key_init = 0;
@@ -169,6 +361,66 @@ rndr_popbuf(struct sd_markdown *rndr, int type)
 	rndr->work_bufs[type].size--;
 }
 
+static inline size_t
+rndr_nesting(struct sd_markdown *rndr)
+{
+	return rndr->work_bufs[BUFFER_SPAN].size +
+		rndr->work_bufs[BUFFER_BLOCK].size + rndr->inplace_depth;
+}
+
+/* rndr_source • document offset of a byte of the text being parsed, or
+ * SD_NO_SOURCE if it doesn't come from the text sources were kept for */
+static inline size_t
+rndr_source(struct sd_markdown *rndr, const uint8_t *data)
+{
+	if (!rndr->track_source || !rndr->line_text || data < rndr->line_text ||
+		data >= rndr->line_text + rndr->line_text_size ||
+		rndr->source_size != rndr->line_text_size)
+		return SD_NO_SOURCE;
+
+	return rndr->source[data - rndr->line_text];
+}
+
+/* rndr_move • moves text being rewritten in place, along with the
+ * document offsets of its bytes when sources are tracked */
+static void
+rndr_move(struct sd_markdown *rndr, uint8_t *dst, const uint8_t *src, size_t size)
+{
+	memmove(dst, src, size);
+
+	if (size == 0 || rndr_source(rndr, src) == SD_NO_SOURCE)
+		return;
+
+	memmove(rndr->source + (dst - rndr->line_text), rndr->source + (src - rndr->line_text),
+		size * sizeof(uint32_t));
+}
+
+/* rndr_line • the first-pass record of the line starting at data, or NULL
+ * if data is not the start of a line of the top-level text. Nested blocks
+ * parse text that was rewritten in place, so they never get one. Blocks
+ * are parsed in document order, so the lookup walks forward. */
+static inline const struct line_info *
+rndr_line(struct sd_markdown *rndr, const uint8_t *data)
+{
+	const struct line_info *lines = (const struct line_info *)rndr->lines->data;
+	size_t count = rndr->lines->size / sizeof(struct line_info);
+	size_t off;
+
+	if (!rndr->line_text || data < rndr->line_text ||
+		data >= rndr->line_text + rndr->line_text_size || rndr_nesting(rndr) != 0)
+		return NULL;
+
+	off = data - rndr->line_text;
+	while (rndr->line_next < count && lines[rndr->line_next].end <= off)
+		rndr->line_next++;
+
+	if (rndr->line_next == count ||
+		(rndr->line_next ? lines[rndr->line_next - 1].end : 0) != off)
+		return NULL;
+
+	return &lines[rndr->line_next];
+}
+
 static void
 unscape_text(struct buf *ob, struct buf *src)
 {
@@ -195,15 +447,51 @@ hash_link_ref(const uint8_t *link_ref, size_t length)
 	return siphash_nocase(link_ref, length, sip_hash_key);
 }
 
+/* init_link_refs • empties a reference table without freeing it */
+static void
+init_link_refs(struct link_refs *refs)
+{
+	memset(refs->initial, 0x0, sizeof refs->initial);
+	refs->bucket = refs->initial;
+	refs->size = REF_TABLE_SIZE;
+	refs->count = 0;
+}
+
+/* grow_link_refs • doubles the number of buckets of a reference table,
+ * leaving it as is when out of memory */
+static void
+grow_link_refs(struct link_refs *refs)
+{
+	size_t size = refs->size * 2, i;
+	struct link_ref **bucket, *ref, *next;
+
+	bucket = calloc(size, sizeof(struct link_ref *));
+	if (!bucket)
+		return;
+
+	for (i = 0; i < refs->size; ++i)
+		for (ref = refs->bucket[i]; ref; ref = next) {
+			next = ref->next;
+			ref->next = bucket[ref->id & (size - 1)];
+			bucket[ref->id & (size - 1)] = ref;
+		}
+
+	if (refs->bucket != refs->initial)
+		free(refs->bucket);
+
+	refs->bucket = bucket;
+	refs->size = size;
+}
+
 static struct link_ref *
 add_link_ref(
-	struct link_ref **references,
+	struct link_refs *references,
 	const uint8_t *name, size_t name_size)
 {
 	unsigned int hash;
 	struct link_ref *ref;
 	hash = hash_link_ref(name, name_size);
-	ref = references[hash % REF_TABLE_SIZE];
+	ref = references->bucket[hash & (references->size - 1)];
 	while (ref != NULL) {
 		/* If a reference with the same label exists already, replace it with the new reference */
 		if (ref->id == hash && ref->label->size == name_size) {
@@ -211,29 +499,35 @@ add_link_ref(
 				bufrelease(ref->label);
 				bufrelease(ref->link);
 				bufrelease(ref->title);
+				ref->title = NULL;
 				return ref;
 			}
 		}
 
 		ref = ref->next;
 	}
+
+	if (references->count >= references->size * 2)
+		grow_link_refs(references);
+
 	ref = calloc(1, sizeof(struct link_ref));
 	if (!ref)
 		return NULL;
 	ref->id = hash;
-	ref->next = references[ref->id % REF_TABLE_SIZE];
+	ref->next = references->bucket[ref->id & (references->size - 1)];
 
-	references[ref->id % REF_TABLE_SIZE] = ref;
+	references->bucket[ref->id & (references->size - 1)] = ref;
+	references->count++;
 	return ref;
 }
 
 static struct link_ref *
-find_link_ref(struct link_ref **references, uint8_t *name, size_t length)
+find_link_ref(const struct link_refs *references, uint8_t *name, size_t length)
 {
 	unsigned int hash = hash_link_ref(name, length);
 	struct link_ref *ref = NULL;
 
-	ref = references[hash % REF_TABLE_SIZE];
+	ref = references->bucket[hash & (references->size - 1)];
 
 	while (ref != NULL) {
 		if (ref->id == hash && ref->label->size == length) {
@@ -249,12 +543,12 @@ find_link_ref(struct link_ref **references, uint8_t *name, size_t length)
 }
 
 static void
-free_link_refs(struct link_ref **references)
+free_link_refs(struct link_refs *references)
 {
 	size_t i;
 
-	for (i = 0; i < REF_TABLE_SIZE; ++i) {
-		struct link_ref *r = references[i];
+	for (i = 0; i < references->size; ++i) {
+		struct link_ref *r = references->bucket[i];
 		struct link_ref *next;
 
 		while (r) {
@@ -266,6 +560,11 @@ free_link_refs(struct link_ref **references)
 			r = next;
 		}
 	}
+
+	if (references->bucket != references->initial)
+		free(references->bucket);
+
+	init_link_refs(references);
 }
 
 /*
@@ -298,7 +597,7 @@ is_mail_autolink(uint8_t *data, size_t size)
 
 	/* address is assumed to be: [-@._a-zA-Z0-9]+ with exactly one '@' */
 	for (i = 0; i < size; ++i) {
-		if (isalnum(data[i]))
+		if (sd_isalnum(data[i]))
 			continue;
 
 		switch (data[i]) {
@@ -321,9 +620,11 @@ is_mail_autolink(uint8_t *data, size_t size)
 	return 0;
 }
 
-/* tag_length • returns the length of the given tag, or 0 is it's not valid */
+/* tag_length • returns the length of the given tag, or 0 is it's not valid;
+ * an autolink whose scan starts at or past *end_none has no end, and
+ * *end_none is lowered when one runs off the data */
 static size_t
-tag_length(uint8_t *data, size_t size, enum mkd_autolink *autolink)
+tag_length(uint8_t *data, size_t size, enum mkd_autolink *autolink, size_t *end_none)
 {
 	size_t i, j;
 
@@ -334,14 +635,14 @@ tag_length(uint8_t *data, size_t size, enum mkd_autolink *autolink)
 	if (data[0] != '<') return 0;
 	i = (data[1] == '/') ? 2 : 1;
 
-	if (!isalnum(data[i]))
+	if (!sd_isalnum(data[i]))
 		return 0;
 
 	/* scheme test */
 	*autolink = MKDA_NOT_AUTOLINK;
 
 	/* try to find the beginning of an URI */
-	while (i < size && (isalnum(data[i]) || data[i] == '.' || data[i] == '+' || data[i] == '-'))
+	while (i < size && (sd_isalnum(data[i]) || data[i] == '.' || data[i] == '+' || data[i] == '-'))
 		i++;
 
 	if (i > 1 && data[i] == '@') {
@@ -362,6 +663,7 @@ tag_length(uint8_t *data, size_t size, enum mkd_autolink *autolink)
 
 	else if (*autolink) {
 		j = i;
+		if (j >= *end_none) return 0;
 
 		while (i < size) {
 			if (data[i] == '\\') i += 2;
@@ -371,7 +673,10 @@ tag_length(uint8_t *data, size_t size, enum mkd_autolink *autolink)
 			else i++;
 		}
 
-		if (i >= size) return 0;
+		if (i >= size) {
+			*end_none = j;
+			return 0;
+		}
 		if (i > j && data[i] == '>') return i + 1;
 		/* one of the forbidden chars has been found */
 		*autolink = MKDA_NOT_AUTOLINK;
@@ -383,6 +688,29 @@ tag_length(uint8_t *data, size_t size, enum mkd_autolink *autolink)
 	return i + 1;
 }
 
+/* char_is_inert • whether the char_* function for the active char at
+ * data[end] would return 0 on sight. This only covers the triggers that
+ * are common in plain prose, and mirrors the early returns of
+ * char_linebreak and the char_autolink_* functions */
+static inline int
+char_is_inert(uint8_t action, uint8_t *data, size_t end, size_t last_special, size_t size)
+{
+	/* nearly every 'w' in prose is not the start of "www." */
+	if (action == MD_CHAR_AUTOLINK_WWW)
+		return size - end < 4 || memcmp(data + end, "www.", 4) != 0;
+
+	if (action == MD_CHAR_LINEBREAK)
+		return end - last_special < 2 || data[end - 1] != ' ' || data[end - 2] != ' ';
+
+	if (action == MD_CHAR_AUTOLINK_URL)
+		return size - end < 4 || data[end + 1] != '/' || data[end + 2] != '/';
+
+	if (action == MD_CHAR_AUTOLINK_SUBREDDIT_OR_USERNAME)
+		return end == last_special || (data[end - 1] != 'r' && data[end - 1] != 'u');
+
+	return 0;
+}
+
 /* parse_inline • parses inline markdown elements */
 static void
 parse_inline(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
@@ -390,17 +718,35 @@ parse_inline(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t siz
 	size_t i = 0, end = 0, last_special = 0;
 	uint8_t action = 0;
 	struct buf work = { 0, 0, 0, 0 };
+	struct inline_span span, *outer = rndr->span;
 
-	if (rndr->work_bufs[BUFFER_SPAN].size +
-		rndr->work_bufs[BUFFER_BLOCK].size > rndr->max_nesting)
+	if (rndr_nesting(rndr) > rndr->max_nesting)
 		return;
 
+	span.data = data;
+	span.size = size;
+	span.brackets_done = 0;
+	span.brackets_from = span.bracket_next = rndr->brackets->size / sizeof(struct bracket);
+	span.link_end_none = span.title_end_none[0] = span.title_end_none[1] = size;
+	span.autolink_end_none = size;
+	span.closers_done = 0;
+	memset(span.emph_scans, 0, sizeof span.emph_scans);
+	memset(span.emph_fails, 0, sizeof span.emph_fails);
+	rndr->span = &span;
+
 	while (i < size) {
 		/* copying inactive chars into the output */
 		while (end < size && (action = rndr->active_char[data[end]]) == 0) {
 			end++;
 		}
 
+		/* active chars that would be rejected on sight stay part of
+		 * the same run, so plain text reaches normal_text in one piece */
+		if (end < size && char_is_inert(action, data, end, last_special, size)) {
+			end++;
+			continue;
+		}
+
 		if (rndr->cb.normal_text) {
 			work.data = data + i;
 			work.size = end - i;
@@ -420,13 +766,387 @@ parse_inline(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t siz
 			last_special = end = i;
 		}
 	}
+
+	for (i = 0; i < EMPH_SCAN_CHARS; ++i) {
+		free(span.emph_scans[i].table);
+		free(span.emph_fails[0][i].table);
+		free(span.emph_fails[1][i].table);
+		free(span.emph_fails[2][i].table);
+	}
+
+	rndr->brackets->size = span.brackets_from * sizeof(struct bracket);
+	rndr->span = outer;
+}
+
+/* is_closer • whether offset i of the span being parsed is the closer */
+static inline int
+is_closer(struct sd_markdown *rndr, size_t i, enum span_closer closer)
+{
+	const uint8_t *data = rndr->span->data;
+	size_t size = rndr->span->size;
+
+	switch (closer) {
+	case CLOSER_EMPH_STAR:
+	case CLOSER_EMPH_UNDERSCORE:
+		return !_isspace(data[i - 1]);
+
+	case CLOSER_EMPH1_UNDERSCORE:
+		if (_isspace(data[i - 1]))
+			return 0;
+		return !(rndr->ext_flags & MKDEXT_NO_INTRA_EMPHASIS) ||
+			i + 1 == size || _isspace(data[i + 1]) || sd_ispunct(data[i + 1]);
+
+	case CLOSER_EMPH2_STAR:
+	case CLOSER_EMPH2_UNDERSCORE:
+	case CLOSER_EMPH2_TILDE:
+	case CLOSER_EMPH2_GT:
+		return i + 1 < size && data[i + 1] == data[i] && !_isspace(data[i - 1]);
+
+	case CLOSER_SPOILER:
+		return data[i - 1] == '!';
+
+	case CLOSER_QUOTE:
+	case CLOSER_DQUOTE:
+		/* only a quote after whitespace opens a link title */
+		return _isspace(data[i - 1]);
+
+	default:
+		return 1;
+	}
+}
+
+/* span_find_closer • whether the closer occurs in the span being parsed
+ * past data; what is known from earlier calls is never searched again,
+ * so the calls for a span take linear time in all */
+static int
+span_find_closer(struct sd_markdown *rndr, const uint8_t *data, enum span_closer closer)
+{
+	static const uint8_t closer_char[CLOSER_COUNT] = {
+		'*', '_', '~', '>', '<', ']', ')', '`', '\\', '\'', '"',
+		'*', '_', '_', '*', '_', '~', '>', '<',
+	};
+	struct inline_span *span = rndr->span;
+	size_t off = data - span->data;
+	const uint8_t *p;
+
+	if (!(span->closers_done & (1u << closer))) {
+		span->closer_next[closer] = 0;
+		span->closer_none[closer] = span->size - 1;
+		span->closers_done |= 1u << closer;
+	}
+
+	if (off < span->closer_next[closer])
+		return 1;
+
+	while (off < span->closer_none[closer]) {
+		p = memchr(span->data + off + 1, closer_char[closer], span->closer_none[closer] - off);
+		if (!p)
+			break;
+
+		off = p - span->data;
+		if (is_closer(rndr, off, closer)) {
+			span->closer_next[closer] = off;
+			return 1;
+		}
+	}
+
+	span->closer_none[closer] = data - span->data;
+	return 0;
+}
+
+/* span_has_closer • whether the closing delimiter c occurs in the span
+ * being parsed past data */
+static int
+span_has_closer(struct sd_markdown *rndr, const uint8_t *data, uint8_t c)
+{
+	switch (c) {
+	case '*': return span_find_closer(rndr, data, CLOSER_STAR);
+	case '_': return span_find_closer(rndr, data, CLOSER_UNDERSCORE);
+	case '~': return span_find_closer(rndr, data, CLOSER_TILDE);
+	case '>': return span_find_closer(rndr, data, CLOSER_GT);
+	case '<': return span_find_closer(rndr, data, CLOSER_LT);
+	case ']': return span_find_closer(rndr, data, CLOSER_BRACKET);
+	case ')': return span_find_closer(rndr, data, CLOSER_PAREN);
+	case '`': return span_find_closer(rndr, data, CLOSER_BACKTICK);
+	case '\'': return span_find_closer(rndr, data, CLOSER_QUOTE);
+	case '"': return span_find_closer(rndr, data, CLOSER_DQUOTE);
+	default: return span_find_closer(rndr, data, CLOSER_BACKSLASH);
+	}
+}
+
+/* span_has_emph_closer • whether a delimiter of n c's that can close
+ * emphasis occurs in the span being parsed past data */
+static int
+span_has_emph_closer(struct sd_markdown *rndr, const uint8_t *data, uint8_t c, int n)
+{
+	if (n == 2) {
+		switch (c) {
+		case '*': return span_find_closer(rndr, data, CLOSER_EMPH2_STAR);
+		case '_': return span_find_closer(rndr, data, CLOSER_EMPH2_UNDERSCORE);
+		case '~': return span_find_closer(rndr, data, CLOSER_EMPH2_TILDE);
+		default: return span_find_closer(rndr, data, CLOSER_EMPH2_GT);
+		}
+	}
+
+	if (c == '*')
+		return span_find_closer(rndr, data, CLOSER_EMPH_STAR);
+
+	return span_find_closer(rndr, data, n == 1 ? CLOSER_EMPH1_UNDERSCORE : CLOSER_EMPH_UNDERSCORE);
+}
+
+/* match_brackets • records the matching ']' of every '[' of the span
+ * from beg on, the way char_link would find it: counting nesting levels
+ * and skipping the characters escaped by a backslash. char_link still
+ * starts from a '[' after a backslash that was itself escaped, which
+ * the scans from the other '[' skip: it closes at the next ']' at its
+ * level without taking one from them */
+static void
+match_brackets(struct sd_markdown *rndr, size_t beg)
+{
+	struct inline_span *span = rndr->span;
+	const uint8_t *data = span->data;
+	struct buf *brackets = rndr->brackets;
+	struct bracket entry, *b;
+	size_t i, top = 0, k;
+
+	/* unmatched entries keep 1 + the index of the enclosing unmatched
+	 * one in their close field, until the end of the span */
+	for (i = beg; i < span->size; i++) {
+		if (data[i] == '[') {
+			entry.open = i;
+			entry.close = top;
+			bufput(brackets, &entry, sizeof entry);
+			top = brackets->size / sizeof entry;
+		}
+		else if (data[i] == ']' && !(i > beg && data[i - 1] == '\\')) {
+			do {
+				if (!top)
+					break;
+
+				b = (struct bracket *)brackets->data + top - 1;
+				top = b->close;
+				b->close = i - b->open;
+			} while (b->open > beg && data[b->open - 1] == '\\');
+		}
+	}
+
+	b = (struct bracket *)brackets->data;
+	while (top) {
+		k = b[top - 1].close;
+		b[top - 1].close = 0;
+		top = k;
+	}
+}
+
+/* span_bracket • sets *close to the offset from data of the ']' matching
+ * the '[' at data, or to 0 if it has none; returns 0 for a '[' before
+ * the ones match_brackets went through */
+static int
+span_bracket(struct sd_markdown *rndr, const uint8_t *data, size_t *close)
+{
+	struct inline_span *span = rndr->span;
+	size_t off = data - span->data, count;
+	const struct bracket *b;
+
+	b = (const struct bracket *)rndr->brackets->data;
+	count = rndr->brackets->size / sizeof(struct bracket);
+
+	while (span->bracket_next < count && b[span->bracket_next].open < off)
+		span->bracket_next++;
+
+	if (span->bracket_next == count || b[span->bracket_next].open != off)
+		return 0;
+
+	*close = b[span->bracket_next].close;
+	return 1;
+}
+
+/* first_char • offset of the first c in data from beg on, or 0 */
+static inline size_t
+first_char(const uint8_t *data, size_t beg, size_t size, uint8_t c)
+{
+	const uint8_t *p = memchr(data + beg, c, size - beg);
+	return p ? (size_t)(p - data) : 0;
+}
+
+/* emph_scan_slot • the slot of the table holding state, or the free
+ * slot it would go in */
+static inline size_t
+emph_scan_slot(const struct emph_scans *scans, size_t state)
+{
+	size_t k = (state * 2654435761u) & scans->mask;
+
+	while (scans->table[k].key && scans->table[k].key != state + 1)
+		k = (k + 1) & scans->mask;
+
+	return k;
+}
+
+/* add_emph_scan • records that the scan from state returned result */
+static void
+add_emph_scan(struct emph_scans *scans, size_t state, size_t result)
+{
+	struct emph_scan *old = scans->table;
+	size_t old_size = old ? scans->mask + 1 : 0, i, k;
+
+	if ((scans->count + 1) * 2 > old_size) {
+		size_t size = old_size ? old_size * 2 : 64;
+		struct emph_scan *table = calloc(size, sizeof *table);
+
+		if (!table)
+			return;
+
+		scans->table = table;
+		scans->mask = size - 1;
+		for (i = 0; i < old_size; ++i) {
+			if (old[i].key)
+				scans->table[emph_scan_slot(scans, old[i].key - 1)] = old[i];
+		}
+		free(old);
+	}
+
+	k = emph_scan_slot(scans, state);
+	if (!scans->table[k].key) {
+		scans->table[k].key = state + 1;
+		scans->table[k].result = result;
+		scans->count++;
+	}
+}
+
+/* emph_scan_index • the emph_scans of a span used for delimiter c, or -1 */
+static int
+emph_scan_index(uint8_t c)
+{
+	switch (c) {
+	case '*': return 0;
+	case '_': return 1;
+	case '~': return 2;
+	case '>': return 3;
+	case '<': return 4;
+	default: return -1;
+	}
+}
+
+/* emph_walk • a find_emph_char scan being recorded: the table of the
+ * span for its delimiter, and the offset in the span of the data scanned */
+struct emph_walk {
+	struct emph_scans *scans;
+	size_t base;
+};
+
+/* emph_walk_step • returns 1 and sets *ret to the offset from the data
+ * scanned that an earlier scan returned from data[i], or notes data[i]
+ * as a state of the scan and returns 0 */
+static int
+emph_walk_step(struct sd_markdown *rndr, struct emph_walk *walk, size_t i, size_t *ret)
+{
+	const struct emph_scan *e;
+	size_t state = walk->base + i;
+
+	if (walk->scans->table) {
+		e = &walk->scans->table[emph_scan_slot(walk->scans, state)];
+		if (e->key) {
+			*ret = e->result ? e->result - walk->base : 0;
+			return 1;
+		}
+	}
+
+	bufput(rndr->emph_states, &state, sizeof state);
+	return 0;
+}
+
+/* reset_block_scan • starts the block scan of the size bytes of text at
+ * data; the caller keeps the one it replaces */
+static void
+reset_block_scan(struct sd_markdown *rndr, const uint8_t *data, size_t size)
+{
+	struct block_scan *scan = &rndr->spoiler_scan;
+	int k;
+
+	scan->start = data;
+	scan->end = data + size;
+	for (k = 0; k < BLOCK_SCAN_CHARS; ++k) {
+		scan->from[k] = scan->end;
+		scan->next[k] = NULL;
+	}
+	memset(&scan->lt, 0, sizeof scan->lt);
+}
+
+/* clear_block_scan • releases the block scan */
+static void
+clear_block_scan(struct sd_markdown *rndr)
+{
+	free(rndr->spoiler_scan.lt.table);
+	memset(&rndr->spoiler_scan, 0, sizeof rndr->spoiler_scan);
+}
+
+/* block_next • the first c at or past data in the block text, or NULL;
+ * data must be in the block text, and c one of those tracked */
+static const uint8_t *
+block_next(struct sd_markdown *rndr, const uint8_t *data, uint8_t c)
+{
+	struct block_scan *scan = &rndr->spoiler_scan;
+	int k;
+
+	switch (c) {
+	case '<': k = BLOCK_SCAN_LT; break;
+	case ']': k = BLOCK_SCAN_BRACKET; break;
+	case ')': k = BLOCK_SCAN_PAREN; break;
+	default: k = BLOCK_SCAN_BACKTICK; break;
+	}
+
+	if (data >= scan->from[k] && (!scan->next[k] || data <= scan->next[k]))
+		return scan->next[k];
+
+	scan->from[k] = data;
+	scan->next[k] = memchr(data, c, scan->end - data);
+	return scan->next[k];
+}
+
+/* scan_has_closer • whether c occurs past data, for scan_emph_char: in
+ * the span being parsed, or outside of one, in the block text that
+ * find_spoiler_lt scans to its end */
+static int
+scan_has_closer(struct sd_markdown *rndr, const uint8_t *data, uint8_t c)
+{
+	if (rndr->span)
+		return span_has_closer(rndr, data, c);
+
+	return block_next(rndr, data + 1, c) != NULL;
+}
+
+/* scan_skip • the offset of the first cc in data from i on, or size,
+ * noting the offset of the first c before it in *first unless one is
+ * noted already */
+static size_t
+scan_skip(struct sd_markdown *rndr, uint8_t *data, size_t i, size_t size,
+	uint8_t cc, uint8_t c, size_t *first)
+{
+	const uint8_t *p, *q;
+
+	/* block text is looked up where find_spoiler_lt scans it */
+	if (rndr && !rndr->span) {
+		p = block_next(rndr, data + i, cc);
+		if (!*first && (q = block_next(rndr, data + i, c)) != NULL && (!p || q < p))
+			*first = q - data;
+
+		return p ? (size_t)(p - data) : size;
+	}
+
+	while (i < size && data[i] != cc) {
+		if (!*first && data[i] == c) *first = i;
+		i++;
+	}
+
+	return i;
 }
 
-/* find_emph_char • looks for the next emph uint8_t, skipping other constructs */
+/* scan_emph_char • looks for the next emph uint8_t, skipping other constructs;
+ * rndr is NULL outside of parse_inline, and walk when not recording */
 static size_t
-find_emph_char(uint8_t *data, size_t size, uint8_t c)
+scan_emph_char(struct sd_markdown *rndr, struct emph_walk *walk, uint8_t *data, size_t size, uint8_t c)
 {
-	size_t i = 1;
+	size_t i = 1, ret;
 
 	while (i < size) {
 		while (i < size && data[i] != c && data[i] != '`' && data[i] != '[')
@@ -441,6 +1161,9 @@ find_emph_char(uint8_t *data, size_t size, uint8_t c)
 		if (data[i] == c)
 			return i;
 
+		if (walk && emph_walk_step(rndr, walk, i, &ret))
+			return ret;
+
 		/* not counting escaped chars */
 		if (i && data[i - 1] == '\\') {
 			i++; continue;
@@ -457,6 +1180,11 @@ find_emph_char(uint8_t *data, size_t size, uint8_t c)
 
 			if (i >= size) return 0;
 
+			/* with no backtick left in the span, the scan below only
+			 * finds the first c */
+			if (rndr && !scan_has_closer(rndr, data + i - 1, '`'))
+				return first_char(data, i, size, c);
+
 			/* finding the matching closing sequence */
 			bt = 0;
 			while (i < size && bt < span_nb) {
@@ -474,10 +1202,10 @@ find_emph_char(uint8_t *data, size_t size, uint8_t c)
 			uint8_t cc;
 
 			i++;
-			while (i < size && data[i] != ']') {
-				if (!tmp_i && data[i] == c) tmp_i = i;
-				i++;
-			}
+			if (rndr && !scan_has_closer(rndr, data + i - 1, ']'))
+				return first_char(data, i, size, c);
+
+			i = scan_skip(rndr, data, i, size, ']', c, &tmp_i);
 
 			i++;
 			while (i < size && (data[i] == ' ' || data[i] == '\n'))
@@ -501,10 +1229,10 @@ find_emph_char(uint8_t *data, size_t size, uint8_t c)
 			}
 
 			i++;
-			while (i < size && data[i] != cc) {
-				if (!tmp_i && data[i] == c) tmp_i = i;
-				i++;
-			}
+			if (rndr && !scan_has_closer(rndr, data + i - 1, cc))
+				return tmp_i ? tmp_i : first_char(data, i, size, c);
+
+			i = scan_skip(rndr, data, i, size, cc, c, &tmp_i);
 
 			if (i >= size)
 				return tmp_i;
@@ -516,13 +1244,109 @@ find_emph_char(uint8_t *data, size_t size, uint8_t c)
 	return 0;
 }
 
+/* walk_emph_char • scan_emph_char of data, which is at offset base of
+ * the text scans records scans to its end for; a scan stepping over many
+ * code spans and links is recorded in turn */
+static size_t
+walk_emph_char(struct sd_markdown *rndr, struct emph_scans *scans, size_t base,
+	uint8_t *data, size_t size, uint8_t c)
+{
+	struct emph_walk walk;
+	const size_t *states;
+	size_t ret, result, count, i;
+
+	walk.scans = scans;
+	walk.base = base;
+
+	rndr->emph_states->size = 0;
+	ret = scan_emph_char(rndr, &walk, data, size, c);
+
+	states = (const size_t *)rndr->emph_states->data;
+	count = rndr->emph_states->size / sizeof *states;
+	if (walk.scans->table || count >= EMPH_SCAN_MEMO) {
+		result = ret ? walk.base + ret : 0;
+		for (i = 0; i < count; ++i)
+			add_emph_scan(walk.scans, states[i], result);
+	}
+
+	return ret;
+}
+
+/* find_emph_char • looks for the next emph uint8_t, skipping other constructs;
+ * rndr is NULL outside of parse_inline. Scans that step over many code
+ * spans and links are recorded, so that openers of the same span whose
+ * scans join them don't walk the rest of the span again */
+static size_t
+find_emph_char(struct sd_markdown *rndr, uint8_t *data, size_t size, uint8_t c)
+{
+	struct inline_span *span = rndr ? rndr->span : NULL;
+	int k = emph_scan_index(c);
+
+	/* what is recorded holds for scans that run to the end of the span */
+	if (!span || k < 0 || data + size != span->data + span->size)
+		return scan_emph_char(rndr, NULL, data, size, c);
+
+	return walk_emph_char(rndr, &span->emph_scans[k], data - span->data, data, size, c);
+}
+
+/* emph_loop_fails • the table of offsets from which the loop of
+ * parse_emph<n> looking for c runs off the span, or NULL when data does
+ * not run to the end of the span */
+static struct emph_scans *
+emph_loop_fails(struct sd_markdown *rndr, const uint8_t *data, size_t size, uint8_t c, int n)
+{
+	struct inline_span *span = rndr->span;
+	int k = emph_scan_index(c);
+
+	if (!span || k < 0 || data + size != span->data + span->size)
+		return NULL;
+
+	return &span->emph_fails[n - 1][k];
+}
+
+/* emph_loop_step • returns 1 if a loop searching from data is known to
+ * run off the span, and otherwise notes data as searched from */
+static int
+emph_loop_step(struct sd_markdown *rndr, struct emph_scans *fails, const uint8_t *data)
+{
+	size_t state;
+
+	if (!fails)
+		return 0;
+
+	state = data - rndr->span->data;
+	if (fails->table && fails->table[emph_scan_slot(fails, state)].key)
+		return 1;
+
+	bufput(rndr->emph_loops, &state, sizeof state);
+	return 0;
+}
+
+/* emph_loop_fail • records the offsets a loop searched from since mark
+ * as running off the span, once there are enough of them; returns 0 */
+static size_t
+emph_loop_fail(struct sd_markdown *rndr, struct emph_scans *fails, size_t mark)
+{
+	const size_t *states = (const size_t *)(rndr->emph_loops->data + mark);
+	size_t count = (rndr->emph_loops->size - mark) / sizeof *states, i;
+
+	if (fails && (fails->table || count >= EMPH_SCAN_MEMO)) {
+		for (i = 0; i < count; ++i)
+			add_emph_scan(fails, states[i], 0);
+	}
+
+	rndr->emph_loops->size = mark;
+	return 0;
+}
+
 /* parse_emph1 • parsing single emphase */
 /* closed by a symbol not preceded by whitespace and not followed by symbol */
 static size_t
 parse_emph1(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, uint8_t c)
 {
-	size_t i = 0, len;
+	size_t i = 0, len, mark;
 	struct buf *work = 0;
+	struct emph_scans *fails;
 	int r;
 
 	if (!rndr->cb.emphasis) return 0;
@@ -530,18 +1354,29 @@ parse_emph1(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 	/* skipping one symbol if coming from emph3 */
 	if (size > 1 && data[0] == c && data[1] == c) i = 1;
 
+	fails = emph_loop_fails(rndr, data, size, c, 1);
+	mark = rndr->emph_loops->size;
+
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
-		if (!len) return 0;
-		i += len;
-		if (i >= size) return 0;
+		if (emph_loop_step(rndr, fails, data + i))
+			return emph_loop_fail(rndr, fails, mark);
+
+		/* every candidate find_emph_char turns up would be rejected */
+		if (!span_has_emph_closer(rndr, data + i, c, 1))
+			return emph_loop_fail(rndr, fails, mark);
+
+		len = find_emph_char(rndr, data + i, size - i, c);
+		if (!len) return emph_loop_fail(rndr, fails, mark);
+		i += len;
+		if (i >= size) return emph_loop_fail(rndr, fails, mark);
 
 		if (data[i] == c && !_isspace(data[i - 1])) {
 			if ((rndr->ext_flags & MKDEXT_NO_INTRA_EMPHASIS) && (c == '_')) {
-				if (!(i + 1 == size || _isspace(data[i + 1]) || ispunct(data[i + 1])))
+				if (!(i + 1 == size || _isspace(data[i + 1]) || sd_ispunct(data[i + 1])))
 					continue;
 			}
 
+			rndr->emph_loops->size = mark;
 			work = rndr_newbuf(rndr, BUFFER_SPAN);
 			parse_inline(work, rndr, data, i);
 			r = rndr->cb.emphasis(ob, work, rndr->opaque);
@@ -550,7 +1385,7 @@ parse_emph1(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 		}
 	}
 
-	return 0;
+	return emph_loop_fail(rndr, fails, mark);
 }
 
 /* parse_emph2 • parsing single emphase */
@@ -558,8 +1393,9 @@ static size_t
 parse_emph2(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, uint8_t c)
 {
 	int (*render_method)(struct buf *ob, const struct buf *text, void *opaque);
-	size_t i = 0, len;
+	size_t i = 0, len, mark;
 	struct buf *work = 0;
+	struct emph_scans *fails;
 	int r;
 
 	render_method = (c == '~') ? rndr->cb.strikethrough : rndr->cb.double_emphasis;
@@ -567,12 +1403,22 @@ parse_emph2(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 	if (!render_method)
 		return 0;
 
+	fails = emph_loop_fails(rndr, data, size, c, 2);
+	mark = rndr->emph_loops->size;
+
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
-		if (!len) return 0;
+		if (emph_loop_step(rndr, fails, data + i))
+			return emph_loop_fail(rndr, fails, mark);
+
+		if (!span_has_emph_closer(rndr, data + i, c, 2))
+			return emph_loop_fail(rndr, fails, mark);
+
+		len = find_emph_char(rndr, data + i, size - i, c);
+		if (!len) return emph_loop_fail(rndr, fails, mark);
 		i += len;
 
 		if (i + 1 < size && data[i] == c && data[i + 1] == c && i && !_isspace(data[i - 1])) {
+			rndr->emph_loops->size = mark;
 			work = rndr_newbuf(rndr, BUFFER_SPAN);
 			parse_inline(work, rndr, data, i);
 			r = render_method(ob, work, rndr->opaque);
@@ -581,7 +1427,7 @@ parse_emph2(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 		}
 		i++;
 	}
-	return 0;
+	return emph_loop_fail(rndr, fails, mark);
 }
 
 /* parse_emph3 • parsing single emphase */
@@ -589,18 +1435,30 @@ parse_emph2(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 static size_t
 parse_emph3(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, uint8_t c)
 {
-	size_t i = 0, len;
+	size_t i = 0, len, mark;
+	struct emph_scans *fails = emph_loop_fails(rndr, data, size, c, 3);
 	int r;
 
+	mark = rndr->emph_loops->size;
+
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
-		if (!len) return 0;
+		if (emph_loop_step(rndr, fails, data + i))
+			return emph_loop_fail(rndr, fails, mark);
+
+		if (!span_has_emph_closer(rndr, data + i, c, 3))
+			return emph_loop_fail(rndr, fails, mark);
+
+		len = find_emph_char(rndr, data + i, size - i, c);
+		if (!len) return emph_loop_fail(rndr, fails, mark);
 		i += len;
 
 		/* skip whitespace preceded symbols */
 		if (data[i] != c || _isspace(data[i - 1]))
 			continue;
 
+		/* the closer decides it from here on */
+		rndr->emph_loops->size = mark;
+
 		if (i + 2 < size && data[i + 1] == c && data[i + 2] == c && rndr->cb.triple_emphasis) {
 			/* triple symbol found */
 			struct buf *work = rndr_newbuf(rndr, BUFFER_SPAN);
@@ -623,7 +1481,7 @@ parse_emph3(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 			else return len - 1;
 		}
 	}
-	return 0;
+	return emph_loop_fail(rndr, fails, mark);
 }
 
 static size_t
@@ -640,7 +1498,10 @@ parse_spoilerspan(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_
 	if (!render_method) return 0;
 
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, '<');
+		if (!span_find_closer(rndr, data + i, CLOSER_SPOILER))
+			return 0;
+
+		len = find_emph_char(rndr, data + i, size - i, '<');
 		if (!len) return 0;
 		i += len;
 
@@ -666,6 +1527,10 @@ char_emphasis(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t ma
 	uint8_t c = data[0];
 	size_t ret;
 
+	/* every form of emphasis needs a closing delimiter further on */
+	if (!span_has_closer(rndr, data, (c == '>' && size > 1 && data[1] == '!') ? '<' : c))
+		return 0;
+
 	if (size > 3 && c == '>' && data[1] == '!') {
 		if(_isspace(data[2]) || (ret = parse_spoilerspan(ob, rndr, data + 2, size - 2)) == 0)
 			return 0;
@@ -802,7 +1667,7 @@ char_entity(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_
 		end++;
 	}
 
-	if (end < size && numeric && tolower(data[end]) == 'x') {
+	if (end < size && numeric && sd_tolower(data[end]) == 'x') {
 		hex = 1;
 		end++;
 	}
@@ -812,10 +1677,10 @@ char_entity(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_
 	while (end < size) {
 		const char c = data[end];
 		if (hex) {
-			if (!isxdigit(c)) break;
+			if (!sd_isxdigit(c)) break;
 		} else if (numeric) {
-			if (!isdigit(c)) break;
-		} else if (!isalnum(c)) {
+			if (!sd_isdigit(c)) break;
+		} else if (!sd_isalnum(c)) {
 			break;
 		}
 		end++;
@@ -870,16 +1735,27 @@ static size_t
 char_langle_tag(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_rewind, size_t max_lookbehind, size_t size)
 {
 	enum mkd_autolink altype = MKDA_NOT_AUTOLINK;
-	size_t end = tag_length(data, size, &altype);
-	struct buf work = { data, end, 0, 0 };
+	size_t end, span_off = data - rndr->span->data, end_none;
+	struct buf work = { data, 0, 0, 0 };
 	int ret = 0;
 
+	/* tags and autolinks alike end with a '>' */
+	if (!span_has_closer(rndr, data, '>'))
+		return 0;
+
+	end_none = rndr->span->autolink_end_none > span_off ?
+		rndr->span->autolink_end_none - span_off : 0;
+	work.size = end = tag_length(data, size, &altype, &end_none);
+	if (span_off + end_none < rndr->span->autolink_end_none)
+		rndr->span->autolink_end_none = span_off + end_none;
+
 	if (end > 2) {
 		if (rndr->cb.autolink && altype != MKDA_NOT_AUTOLINK) {
 			struct buf *u_link = rndr_newbuf(rndr, BUFFER_SPAN);
 			work.data = data + 1;
 			work.size = end - 2;
 			unscape_text(u_link, &work);
+			rndr->link_source = rndr_source(rndr, work.data);
 			ret = rndr->cb.autolink(ob, u_link, altype, rndr->opaque);
 			rndr_popbuf(rndr, BUFFER_SPAN);
 		}
@@ -908,6 +1784,7 @@ char_autolink_www(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_
 		bufput(link_url, link->data, link->size);
 
 		buftruncate(ob, ob->size - rewind);
+		rndr->link_source = rndr_source(rndr, data - rewind);
 		if (rndr->cb.normal_text) {
 			link_text = rndr_newbuf(rndr, BUFFER_SPAN);
 			rndr->cb.normal_text(link_text, link, rndr->opaque);
@@ -947,6 +1824,7 @@ char_autolink_subreddit_or_username(struct buf *ob, struct sd_markdown *rndr, ui
 		bufput(link_url, link->data, link->size);
 
 		buftruncate(ob, ob->size - rewind);
+		rndr->link_source = rndr_source(rndr, data - rewind);
 		if (rndr->cb.normal_text) {
 			link_text = rndr_newbuf(rndr, BUFFER_SPAN);
 			rndr->cb.normal_text(link_text, link, rndr->opaque);
@@ -975,6 +1853,7 @@ char_autolink_email(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, siz
 
 	if ((link_len = sd_autolink__email(&rewind, link, data, max_rewind, size, 0)) > 0) {
 		buftruncate(ob, ob->size - rewind);
+		rndr->link_source = rndr_source(rndr, data - rewind);
 		rndr->cb.autolink(ob, link, MKDA_EMAIL, rndr->opaque);
 	}
 
@@ -995,6 +1874,7 @@ char_autolink_url(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_
 
 	if ((link_len = sd_autolink__url(&rewind, link, data, max_rewind, size, 0)) > 0) {
 		buftruncate(ob, ob->size - rewind);
+		rndr->link_source = rndr_source(rndr, data - rewind);
 		rndr->cb.autolink(ob, link, MKDA_NORMAL, rndr->opaque);
 	}
 
@@ -1013,15 +1893,26 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 	struct buf *title = 0;
 	struct buf *u_link = 0;
 	size_t org_work_size = rndr->work_bufs[BUFFER_SPAN].size;
+	size_t link_source = SD_NO_SOURCE;
 	int text_has_nl = 0, ret = 0;
 	int in_title = 0, qtype = 0;
+	size_t span_off = data - rndr->span->data, *title_none;
 
 	/* checking whether the correct renderer exists */
 	if ((is_img && !rndr->cb.image) || (!is_img && !rndr->cb.link))
 		goto cleanup;
 
-	/* looking for the matching closing bracket */
-	for (level = 1; i < size; i++) {
+	/* looking for the matching closing bracket; once a '[' of the span
+	 * turns out to have none, all the ones after it are matched at once
+	 * rather than each scanning to the end of the span */
+	if (rndr->span->brackets_done && span_bracket(rndr, data, &txt_e)) {
+		if (!txt_e)
+			goto cleanup;
+
+		i = txt_e;
+		text_has_nl = memchr(data + 1, '\n', i - 1) != NULL;
+	}
+	else for (level = 1; i < size; i++) {
 		if (data[i] == '\n')
 			text_has_nl = 1;
 
@@ -1038,8 +1929,13 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 		}
 	}
 
-	if (i >= size)
+	if (i >= size) {
+		if (!rndr->span->brackets_done) {
+			match_brackets(rndr, data - rndr->span->data);
+			rndr->span->brackets_done = 1;
+		}
 		goto cleanup;
+	}
 
 	txt_e = i;
 	i++;
@@ -1060,6 +1956,12 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 		link_b = i;
 
 		/* looking for link end: ' " ) */
+		if (span_off + i >= rndr->span->link_end_none ||
+			(!span_has_closer(rndr, data + i - 1, ')') &&
+			!span_has_closer(rndr, data + i - 1, '\'') &&
+			!span_has_closer(rndr, data + i - 1, '"')))
+			goto cleanup;
+
 		while (i < size) {
 			if (data[i] == '\\') i += 2;
 			else if (data[i] == ')') break;
@@ -1067,7 +1969,11 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 			else i++;
 		}
 
-		if (i >= size) goto cleanup;
+		if (i >= size) {
+			rndr->span->link_end_none = span_off + link_b;
+			goto cleanup;
+		}
+
 		link_e = i;
 
 		/* looking for title end if present */
@@ -1077,6 +1983,10 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 			i++;
 			title_b = i;
 
+			title_none = &rndr->span->title_end_none[qtype == '"' ? 0 : 1];
+			if (span_off + i >= *title_none || !span_has_closer(rndr, data + i - 1, ')'))
+				goto cleanup;
+
 			while (i < size) {
 				if (data[i] == '\\') i += 2;
 				else if (data[i] == qtype) {in_title = 0; i++;}
@@ -1084,7 +1994,10 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 				else i++;
 			}
 
-			if (i >= size) goto cleanup;
+			if (i >= size) {
+				*title_none = span_off + title_b;
+				goto cleanup;
+			}
 
 			/* skipping whitespaces after title */
 			title_e = i - 1;
@@ -1110,6 +2023,7 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 		if (link_e > link_b) {
 			link = rndr_newbuf(rndr, BUFFER_SPAN);
 			bufput(link, data + link_b, link_e - link_b);
+			link_source = rndr_source(rndr, data + link_b);
 		}
 
 		if (title_e > title_b) {
@@ -1128,6 +2042,9 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 		/* looking for the id */
 		i++;
 		link_b = i;
+		if (!span_has_closer(rndr, data + i - 1, ']'))
+			goto cleanup;
+
 		while (i < size && data[i] != ']') i++;
 		if (i >= size) goto cleanup;
 		link_e = i;
@@ -1156,13 +2073,15 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 			id.size = link_e - link_b;
 		}
 
-		lr = find_link_ref(rndr->refs, id.data, id.size);
+		lr = find_link_ref(&rndr->refs, id.data, id.size);
 		if (!lr)
 			goto cleanup;
 
 		/* keeping link and title from link_ref */
 		link = lr->link;
 		title = lr->title;
+		if (rndr->track_source)
+			link_source = lr->source;
 		i++;
 	}
 
@@ -1191,13 +2110,15 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 		}
 
 		/* finding the link_ref */
-		lr = find_link_ref(rndr->refs, id.data, id.size);
+		lr = find_link_ref(&rndr->refs, id.data, id.size);
 		if (!lr)
 			goto cleanup;
 
 		/* keeping link and title from link_ref */
 		link = lr->link;
 		title = lr->title;
+		if (rndr->track_source)
+			link_source = lr->source;
 
 		/* rewinding the whitespace */
 		i = txt_e + 1;
@@ -1224,7 +2145,9 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t max_re
 		goto cleanup;
 	}
 
-	/* calling the relevant rendering function */
+	/* calling the relevant rendering function; the content may have
+	 * had links of its own */
+	rndr->link_source = link_source;
 	if (is_img) {
 		if (ob->size && ob->data[ob->size - 1] == '!')
 			ob->size -= 1;
@@ -1253,6 +2176,10 @@ char_superscript(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 		return 0;
 
 	if (data[1] == '(') {
+		/* the scan below stops at a ')' or past a backslash */
+		if (!span_has_closer(rndr, data + 1, ')') && !span_has_closer(rndr, data, '\\'))
+			return 0;
+
 		sup_start = sup_len = 2;
 
 		while (sup_len < size && data[sup_len] != ')' && data[sup_len - 1] != '\\')
@@ -1282,6 +2209,29 @@ char_superscript(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
  * BLOCK-LEVEL PARSING FUNCTIONS *
  *********************************/
 
+/* block parsers that can match a line, besides tables and paragraphs,
+ * keyed on its first byte after up to three spaces of indentation */
+#define BLOCK_EMPTY	1
+#define BLOCK_HRULE	2
+#define BLOCK_FENCE	4
+#define BLOCK_QUOTE	8
+#define BLOCK_CODE	16
+#define BLOCK_ULI	32
+#define BLOCK_OLI	64
+#define BLOCK_TABLE	128	/* line has a '|'; only set by copy_document */
+
+/* nothing past 0x7f starts a block */
+static const uint8_t block_starts[256] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x22, 0x20, 0x00, 0x22, 0x00, 0x00,
+	0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+	0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00,
+};
+
 /* is_empty • returns the line length when it is empty, 0 otherwise */
 static size_t
 is_empty(uint8_t *data, size_t size)
@@ -1488,8 +2438,26 @@ prefix_quote(uint8_t *data, size_t size)
 	return 0;
 }
 
+/* find_spoiler_lt • find_emph_char(NULL, data, size, '<'), which only
+ * ever returns the offset of a '<'; scans to the end of the block text
+ * skip what it holds none of */
 static size_t
-prefix_blockspoiler(uint8_t *data, size_t size)
+find_spoiler_lt(struct sd_markdown *rndr, uint8_t *data, size_t size)
+{
+	struct block_scan *scan = &rndr->spoiler_scan;
+
+	if (data + size == scan->end && !rndr->span && size > 1) {
+		if (!scan_has_closer(rndr, data, '<'))
+			return 0;
+
+		return walk_emph_char(rndr, &scan->lt, data - scan->start, data, size, '<');
+	}
+
+	return find_emph_char(NULL, data, size, '<');
+}
+
+static size_t
+prefix_blockspoiler(struct sd_markdown *rndr, uint8_t *data, size_t size)
 {
     size_t i = 0;
     if (i < size && data[i] == ' ') i++;
@@ -1497,7 +2465,7 @@ prefix_blockspoiler(uint8_t *data, size_t size)
     if (i < size && data[i] == ' ') i++;
 
     if (i + 1 < size && data[i] == '>' && data[i + 1] == '!') {
-		size_t spoilerspan = find_emph_char(data + i + 1, size - i - 1, '<');
+		size_t spoilerspan = find_spoiler_lt(rndr, data + i + 1, size - i - 1);
 		if (i + spoilerspan < size && spoilerspan > 0 && data[i + spoilerspan] == '!')
 			return 0;
 
@@ -1576,11 +2544,10 @@ static void parse_block(struct buf *ob, struct sd_markdown *rndr,
 static size_t
 parse_blockquote(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
 {
-	size_t beg, end = 0, pre, work_size = 0;
+	size_t beg, end = 0, pre, work_size = 0, mark = 0;
 	uint8_t *work_data = 0;
 	struct buf *out = 0;
 
-	out = rndr_newbuf(rndr, BUFFER_BLOCK);
 	beg = 0;
 	while (beg < size) {
 		for (end = beg + 1; end < size && data[end - 1] != '\n'; end++);
@@ -1601,12 +2568,22 @@ parse_blockquote(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 			if (!work_data)
 				work_data = data + beg;
 			else if (data + beg != work_data + work_size)
-				memmove(work_data + work_size, data + beg, end - beg);
+				rndr_move(rndr, work_data + work_size, data + beg, end - beg);
 			work_size += end - beg;
 		}
 		beg = end;
 	}
 
+	if (rndr->cb.container_open) {
+		mark = rndr->cb.container_open(ob, MKD_CONTAINER_BLOCKQUOTE, 0, rndr->opaque);
+		rndr->inplace_depth++;
+		parse_block(ob, rndr, work_data, work_size);
+		rndr->inplace_depth--;
+		rndr->cb.container_close(ob, MKD_CONTAINER_BLOCKQUOTE, 0, mark, rndr->opaque);
+		return end;
+	}
+
+	out = rndr_newbuf(rndr, BUFFER_BLOCK);
 	parse_block(out, rndr, work_data, work_size);
 	if (rndr->cb.blockquote)
 		rndr->cb.blockquote(ob, out, rndr->opaque);
@@ -1618,23 +2595,22 @@ parse_blockquote(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 static size_t
 parse_blockspoiler(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
 {
-	size_t beg, end = 0, pre, work_size = 0;
+	size_t beg, end = 0, pre, work_size = 0, mark = 0;
 	uint8_t *work_data = 0;
 	struct buf *out = 0;
 
-	out = rndr_newbuf(rndr, BUFFER_BLOCK);
 	beg = 0;
 	while (beg < size) {
 		for (end = beg + 1; end < size && data[end - 1] != '\n'; end++);
 
-		pre = prefix_blockspoiler(data + beg, end - beg);
+		pre = prefix_blockspoiler(rndr, data + beg, end - beg);
 
 		if (pre)
 			beg += pre; /* skipping prefix */
 
 		/* empty line followed by non-blockspoiler line */
 		else if (is_empty(data + beg, end - beg) &&
-				(end >= size || (prefix_blockspoiler(data + end, size - end) == 0 &&
+				(end >= size || (prefix_blockspoiler(rndr, data + end, size - end) == 0 &&
 				!is_empty(data + end, size - end))))
 			break;
 
@@ -1643,12 +2619,22 @@ parse_blockspoiler(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size
 			if (!work_data)
 				work_data = data + beg;
 			else if (data + beg != work_data + work_size)
-				memmove(work_data + work_size, data + beg, end - beg);
+				rndr_move(rndr, work_data + work_size, data + beg, end - beg);
 			work_size += end - beg;
 		}
 		beg = end;
 	}
 
+	if (rndr->cb.container_open) {
+		mark = rndr->cb.container_open(ob, MKD_CONTAINER_BLOCKSPOILER, 0, rndr->opaque);
+		rndr->inplace_depth++;
+		parse_block(ob, rndr, work_data, work_size);
+		rndr->inplace_depth--;
+		rndr->cb.container_close(ob, MKD_CONTAINER_BLOCKSPOILER, 0, mark, rndr->opaque);
+		return end;
+	}
+
+	out = rndr_newbuf(rndr, BUFFER_BLOCK);
 	parse_block(out, rndr, work_data, work_size);
 	if (rndr->cb.blockspoiler)
 		rndr->cb.blockspoiler(ob, out, rndr->opaque);
@@ -1659,16 +2645,40 @@ parse_blockspoiler(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size
 static size_t
 parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, int do_render);
 
-/* parse_blockquote • handles parsing of a regular paragraph */
+/* may_end_paragraph • whether a line starting with c may end a paragraph,
+ * by starting another block or underlining it as a header; none of the
+ * checks in parse_paragraph match a line starting with anything else */
+static inline int
+may_end_paragraph(uint8_t c)
+{
+	switch (c) {
+	case ' ': case '\n': case '#': case '=': case '-': case '>':
+	case '*': case '_': case '+': case '<': case '`': case '~':
+		return 1;
+	}
+
+	return 0;
+}
+
+/* parse_paragraph • handles parsing of a regular paragraph */
 static size_t
 parse_paragraph(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
 {
-	size_t i = 0, end = 0;
+	const struct line_info *line = rndr_line(rndr, data);
+	size_t i = 0, end = 0, base = line ? data - rndr->line_text : 0;
 	int level = 0;
 	struct buf work = { data, 0, 0, 0 };
 
 	while (i < size) {
-		for (end = i + 1; end < size && data[end - 1] != '\n'; end++) /* empty */;
+		if (line)
+			end = (line++)->end - base;
+		else
+			for (end = i + 1; end < size && data[end - 1] != '\n'; end++) /* empty */;
+
+		if (!may_end_paragraph(data[i])) {
+			i = end;
+			continue;
+		}
 
 		if (prefix_quote(data + i, end - i) != 0) {
 			end = i;
@@ -1697,7 +2707,7 @@ parse_paragraph(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 		 * let's check to see if there's some kind of block starting
 		 * here
 		 */
-		if ((rndr->ext_flags & MKDEXT_LAX_SPACING) && !isalnum(data[i])) {
+		if ((rndr->ext_flags & MKDEXT_LAX_SPACING) && !sd_isalnum(data[i])) {
 			if (prefix_oli(data + i, size - i) ||
 				prefix_uli(data + i, size - i)) {
 				end = i;
@@ -1766,6 +2776,7 @@ parse_paragraph(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 
 		if (rndr->cb.header)
 			rndr->cb.header(ob, header_work, (int)level, rndr->opaque);
+		rndr->header_count++;
 
 		rndr_popbuf(rndr, BUFFER_SPAN);
 	}
@@ -1864,8 +2875,10 @@ parse_blockcode(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 static size_t
 parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, int *flags)
 {
-	struct buf *work = 0, *inter = 0;
-	size_t beg = 0, end, pre, sublist = 0, orgpre = 0, i;
+	struct buf *inter = 0;
+	size_t beg = 0, end, pre, sublist = 0, orgpre = 0, i, mark = 0;
+	size_t work_size = 0;
+	uint8_t *work_data = 0;
 	int in_empty = 0, has_inside_empty = 0, in_fence = 0;
 
 	/* keeping track of the first indentation prefix */
@@ -1884,12 +2897,12 @@ parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t s
 	while (end < size && data[end - 1] != '\n')
 		end++;
 
-	/* getting working buffers */
-	work = rndr_newbuf(rndr, BUFFER_SPAN);
-	inter = rndr_newbuf(rndr, BUFFER_SPAN);
-
-	/* putting the first line into the working buffer */
-	bufput(work, data + beg, end - beg);
+	/* the item is assembled in place: each line moves down over the
+	 * prefixes and empty lines dropped before it, so it never overtakes
+	 * the source still to be read. The first line stays where it is. */
+	work_data = data + beg;
+	work_size = end - beg;
+	rndr->inplace_depth++;
 	beg = end;
 
 	/* process the following lines */
@@ -1944,7 +2957,7 @@ parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t s
 				break;             /* the same indentation */
 
 			if (!sublist)
-				sublist = work->size;
+				sublist = work_size;
 		}
 		/* joining only indented stuff after empty lines;
 		 * note that now we only require 1 space of indentation
@@ -1954,14 +2967,17 @@ parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t s
 			break;
 		}
 		else if (in_empty) {
-			bufputc(work, '\n');
+			/* the newline of the empty line before */
+			rndr_move(rndr, work_data + work_size++, data + beg - 1, 1);
 			has_inside_empty = 1;
 		}
 
 		in_empty = 0;
 
 		/* adding the line without prefix into the working buffer */
-		bufput(work, data + beg + i, end - beg - i);
+		if (data + beg + i != work_data + work_size)
+			rndr_move(rndr, work_data + work_size, data + beg + i, end - beg - i);
+		work_size += end - beg - i;
 		beg = end;
 	}
 
@@ -1969,30 +2985,42 @@ parse_listitem(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t s
 	if (has_inside_empty)
 		*flags |= MKD_LI_BLOCK;
 
+	if (rndr->cb.container_open) {
+		mark = rndr->cb.container_open(ob, MKD_CONTAINER_LISTITEM, *flags, rndr->opaque);
+		rndr->inplace_depth++;
+		inter = ob;
+	} else
+		inter = rndr_newbuf(rndr, BUFFER_SPAN);
+
 	if (*flags & MKD_LI_BLOCK) {
 		/* intermediate render of block li */
-		if (sublist && sublist < work->size) {
-			parse_block(inter, rndr, work->data, sublist);
-			parse_block(inter, rndr, work->data + sublist, work->size - sublist);
+		if (sublist && sublist < work_size) {
+			parse_block(inter, rndr, work_data, sublist);
+			parse_block(inter, rndr, work_data + sublist, work_size - sublist);
 		}
 		else
-			parse_block(inter, rndr, work->data, work->size);
+			parse_block(inter, rndr, work_data, work_size);
 	} else {
 		/* intermediate render of inline li */
-		if (sublist && sublist < work->size) {
-			parse_inline(inter, rndr, work->data, sublist);
-			parse_block(inter, rndr, work->data + sublist, work->size - sublist);
+		if (sublist && sublist < work_size) {
+			parse_inline(inter, rndr, work_data, sublist);
+			parse_block(inter, rndr, work_data + sublist, work_size - sublist);
 		}
 		else
-			parse_inline(inter, rndr, work->data, work->size);
+			parse_inline(inter, rndr, work_data, work_size);
 	}
 
 	/* render of li itself */
-	if (rndr->cb.listitem)
-		rndr->cb.listitem(ob, inter, *flags, rndr->opaque);
+	if (rndr->cb.container_open) {
+		rndr->inplace_depth--;
+		rndr->cb.container_close(ob, MKD_CONTAINER_LISTITEM, *flags, mark, rndr->opaque);
+	} else {
+		if (rndr->cb.listitem)
+			rndr->cb.listitem(ob, inter, *flags, rndr->opaque);
+		rndr_popbuf(rndr, BUFFER_SPAN);
+	}
 
-	rndr_popbuf(rndr, BUFFER_SPAN);
-	rndr_popbuf(rndr, BUFFER_SPAN);
+	rndr->inplace_depth--;
 	return beg;
 }
 
@@ -2002,9 +3030,14 @@ static size_t
 parse_list(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, int flags)
 {
 	struct buf *work = 0;
-	size_t i = 0, j;
+	size_t i = 0, j, mark = 0;
 
-	work = rndr_newbuf(rndr, BUFFER_BLOCK);
+	if (rndr->cb.container_open) {
+		mark = rndr->cb.container_open(ob, MKD_CONTAINER_LIST, flags, rndr->opaque);
+		rndr->inplace_depth++;
+		work = ob;
+	} else
+		work = rndr_newbuf(rndr, BUFFER_BLOCK);
 
 	while (i < size) {
 		j = parse_listitem(work, rndr, data + i, size - i, &flags);
@@ -2014,6 +3047,12 @@ parse_list(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size,
 			break;
 	}
 
+	if (rndr->cb.container_open) {
+		rndr->inplace_depth--;
+		rndr->cb.container_close(ob, MKD_CONTAINER_LIST, flags, mark, rndr->opaque);
+		return i;
+	}
+
 	if (rndr->cb.list)
 		rndr->cb.list(ob, work, flags, rndr->opaque);
 	rndr_popbuf(rndr, BUFFER_BLOCK);
@@ -2048,6 +3087,7 @@ parse_atxheader(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 
 		if (rndr->cb.header)
 			rndr->cb.header(ob, work, (int)level, rndr->opaque);
+		rndr->header_count++;
 
 		rndr_popbuf(rndr, BUFFER_SPAN);
 	}
@@ -2096,17 +3136,19 @@ htmlblock_end(const char *curtag,
 	int start_of_line)
 {
 	size_t tag_size = strlen(curtag);
-	size_t i = 1, end_tag;
-	int block_lines = 0;
+	size_t i, from = 1, end_tag, first_line;
+	const uint8_t *p;
 
-	while (i < size) {
-		i++;
-		while (i < size && !(data[i - 1] == '<' && data[i] == '/')) {
-			if (data[i] == '\n')
-				block_lines++;
+	p = memchr(data, '\n', size);
+	first_line = p ? (size_t)(p - data) : size;
 
-			i++;
-		}
+	/* i is the '/' of each "</" past the opening '<' */
+	while (from + 1 < size && (p = memchr(data + from, '<', size - from - 1)) != NULL) {
+		i = p - data + 1;
+		from = i;
+
+		if (data[i] != '/')
+			continue;
 
 		/* If we are only looking for unindented tags, skip the tag
 		 * if it doesn't follow a newline.
@@ -2115,7 +3157,7 @@ htmlblock_end(const char *curtag,
 		 * initial line; in that case it still counts as a closing
 		 * tag
 		 */
-		if (start_of_line && block_lines > 0 && data[i - 2] != '\n')
+		if (start_of_line && first_line < i && data[i - 2] != '\n')
 			continue;
 
 		if (i + 2 + tag_size >= size)
@@ -2129,12 +3171,47 @@ htmlblock_end(const char *curtag,
 	return 0;
 }
 
+/* htmlblock_unclosed • whether the top-level text is known to have no
+ * closing tag for curtag past offset `off` */
+static int
+htmlblock_unclosed(struct sd_markdown *rndr, const char *curtag, size_t off)
+{
+	size_t i;
+
+	for (i = 0; i < rndr->html_unclosed_count; ++i)
+		if (rndr->html_unclosed[i].tag == curtag)
+			return rndr->html_unclosed[i].from <= off;
+
+	return 0;
+}
+
+/* htmlblock_set_unclosed • records that no closing tag for curtag
+ * matches past offset `off` of the top-level text */
+static void
+htmlblock_set_unclosed(struct sd_markdown *rndr, const char *curtag, size_t off)
+{
+	size_t i;
+
+	for (i = 0; i < rndr->html_unclosed_count; ++i)
+		if (rndr->html_unclosed[i].tag == curtag) {
+			if (off < rndr->html_unclosed[i].from)
+				rndr->html_unclosed[i].from = off;
+			return;
+		}
+
+	if (i < HTML_UNCLOSED_TAGS) {
+		rndr->html_unclosed[i].tag = curtag;
+		rndr->html_unclosed[i].from = off;
+		rndr->html_unclosed_count++;
+	}
+}
+
 
 /* parse_htmlblock • parsing of inline HTML block */
 static size_t
 parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, int do_render)
 {
-	size_t i, j = 0, tag_end;
+	size_t i, j = 0, tag_end, text_off = (size_t)-1;
 	const char *curtag = NULL;
 	struct buf work = { data, 0, 0, 0 };
 
@@ -2194,6 +3271,17 @@ parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 		return 0;
 	}
 
+	/* blocks of the top-level text remember the tags they found no
+	 * closing tag for, so that repeated unclosed blocks don't each scan
+	 * the rest of the document; the second pass below tries every
+	 * closing tag, so its failure holds for any later start */
+	if (rndr->line_text && data >= rndr->line_text &&
+		data + size == rndr->line_text + rndr->line_text_size && rndr_nesting(rndr) == 0) {
+		text_off = data - rndr->line_text;
+		if (htmlblock_unclosed(rndr, curtag, text_off))
+			return 0;
+	}
+
 	/* looking for an unindented matching closing tag */
 	/*	followed by a blank line */
 	tag_end = htmlblock_end(curtag, rndr, data, size, 1);
@@ -2202,6 +3290,9 @@ parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 	/* but not if tag is "ins" or "del" (following original Markdown.pl) */
 	if (!tag_end && strcmp(curtag, "ins") != 0 && strcmp(curtag, "del") != 0) {
 		tag_end = htmlblock_end(curtag, rndr, data, size, 0);
+
+		if (!tag_end && text_off != (size_t)-1)
+			htmlblock_set_unclosed(rndr, curtag, text_off);
 	}
 
 	if (!tag_end)
@@ -2215,6 +3306,8 @@ parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 	return tag_end;
 }
 
+/* parse_table_row • renders one row of a table, splitting the cells at
+ * the pipes memchr finds */
 static void
 parse_table_row(
 	struct buf *ob,
@@ -2222,43 +3315,57 @@ parse_table_row(
 	uint8_t *data,
 	size_t size,
 	size_t columns,
-	int *col_data,
+	const int *col_data,
 	int header_flag)
 {
-	size_t i = 0, col, cols_left;
+	size_t i = 0, col, cols_left, mark = 0;
 	struct buf *row_work = 0;
+	const uint8_t *pipe;
 
 	if (!rndr->cb.table_cell || !rndr->cb.table_row)
 		return;
 
-	row_work = rndr_newbuf(rndr, BUFFER_SPAN);
+	if (rndr->cb.container_open) {
+		mark = rndr->cb.container_open(ob, MKD_CONTAINER_TABLE_ROW, header_flag, rndr->opaque);
+		rndr->inplace_depth++;
+		row_work = ob;
+	} else
+		row_work = rndr_newbuf(rndr, BUFFER_SPAN);
 
 	if (i < size && data[i] == '|')
 		i++;
 
 	for (col = 0; col < columns && i < size; ++col) {
-		size_t cell_start, cell_end;
-		struct buf *cell_work;
-
-		cell_work = rndr_newbuf(rndr, BUFFER_SPAN);
+		size_t cell_start, cell_end, cell_mark;
+		int flags = col_data[col] | header_flag;
 
 		while (i < size && _isspace(data[i]))
 			i++;
 
 		cell_start = i;
 
-		while (i < size && data[i] != '|')
-			i++;
+		pipe = memchr(data + i, '|', size - i);
+		i = pipe ? (size_t)(pipe - data) : size;
 
 		cell_end = i - 1;
 
 		while (cell_end > cell_start && _isspace(data[cell_end]))
 			cell_end--;
 
-		parse_inline(cell_work, rndr, data + cell_start, 1 + cell_end - cell_start);
-		rndr->cb.table_cell(row_work, cell_work, col_data[col] | header_flag, rndr->opaque, 0);
+		if (rndr->cb.container_open) {
+			cell_mark = rndr->cb.container_open(row_work, MKD_CONTAINER_TABLE_CELL, flags, rndr->opaque);
+			rndr->inplace_depth++;
+			parse_inline(row_work, rndr, data + cell_start, 1 + cell_end - cell_start);
+			rndr->inplace_depth--;
+			rndr->cb.container_close(row_work, MKD_CONTAINER_TABLE_CELL, flags, cell_mark, rndr->opaque);
+		} else {
+			struct buf *cell_work = rndr_newbuf(rndr, BUFFER_SPAN);
+
+			parse_inline(cell_work, rndr, data + cell_start, 1 + cell_end - cell_start);
+			rndr->cb.table_cell(row_work, cell_work, flags, rndr->opaque, 0);
+			rndr_popbuf(rndr, BUFFER_SPAN);
+		}
 
-		rndr_popbuf(rndr, BUFFER_SPAN);
 		i++;
 	}
 
@@ -2268,19 +3375,27 @@ parse_table_row(
 		rndr->cb.table_cell(row_work, &empty_cell, col_data[col] | header_flag, rndr->opaque, cols_left);
 	}
 
-	rndr->cb.table_row(ob, row_work, rndr->opaque);
+	if (rndr->cb.container_open) {
+		rndr->inplace_depth--;
+		rndr->cb.container_close(ob, MKD_CONTAINER_TABLE_ROW, header_flag, mark, rndr->opaque);
+		return;
+	}
 
+	rndr->cb.table_row(ob, row_work, rndr->opaque);
 	rndr_popbuf(rndr, BUFFER_SPAN);
 }
 
+/* parse_table_header • checks the header line and its underline, and
+ * returns the offset past them, or 0 if they don't start a table. The
+ * column flags go to the renderer's table_cols buffer. */
 static size_t
 parse_table_header(
-	struct buf *ob,
 	struct sd_markdown *rndr,
 	uint8_t *data,
 	size_t size,
 	size_t *columns,
-	int **column_data)
+	int **column_data,
+	size_t *header_size)
 {
 	int pipes;
 	size_t i = 0, col, header_end, under_end;
@@ -2308,7 +3423,12 @@ parse_table_header(
 		return 0;
 
 	*columns = pipes + 1;
-	*column_data = calloc(*columns, sizeof(int));
+	*header_size = header_end;
+
+	rndr->table_cols->size = 0;
+	bufgrow(rndr->table_cols, *columns * sizeof(int));
+	*column_data = (int *)rndr->table_cols->data;
+	memset(*column_data, 0x0, *columns * sizeof(int));
 
 	/* Parse the header underline */
 	i++;
@@ -2354,17 +3474,12 @@ parse_table_header(
 	if (col < *columns)
 		return 0;
 
-	parse_table_row(
-		ob, rndr, data,
-		header_end,
-		*columns,
-		*column_data,
-		MKD_TABLE_HEADER
-	);
-
 	return under_end + 1;
 }
 
+/* parse_table • parsing of a table. Rows end at the next '\n' and stop
+ * the table unless they have a pipe; at the top level the first pass
+ * already recorded both, elsewhere memchr finds them. */
 static size_t
 parse_table(
 	struct buf *ob,
@@ -2372,119 +3487,167 @@ parse_table(
 	uint8_t *data,
 	size_t size)
 {
-	size_t i;
-
+	const struct line_info *line = rndr_line(rndr, data);
+	size_t i, row_start, base = line ? data - rndr->line_text : 0;
+	size_t columns, header_size, mark = 0, part_mark = 0;
 	struct buf *header_work = 0;
 	struct buf *body_work = 0;
-
-	size_t columns;
 	int *col_data = NULL;
+	int in_place = rndr->cb.container_open && rndr->cb.table;
+	const uint8_t *end;
+	int pipe;
 
-	header_work = rndr_newbuf(rndr, BUFFER_SPAN);
-	body_work = rndr_newbuf(rndr, BUFFER_BLOCK);
+	i = parse_table_header(rndr, data, size, &columns, &col_data, &header_size);
+	if (i == 0)
+		return 0;
 
-	i = parse_table_header(header_work, rndr, data, size, &columns, &col_data);
-	if (i > 0) {
+	if (in_place) {
+		mark = rndr->cb.container_open(ob, MKD_CONTAINER_TABLE, 0, rndr->opaque);
+		part_mark = rndr->cb.container_open(ob, MKD_CONTAINER_TABLE_HEADER, 0, rndr->opaque);
+		rndr->inplace_depth += 2;
+		header_work = body_work = ob;
+	} else {
+		header_work = rndr_newbuf(rndr, BUFFER_SPAN);
+		body_work = rndr_newbuf(rndr, BUFFER_BLOCK);
+	}
 
-		while (i < size) {
-			size_t row_start;
-			int pipes = 0;
+	parse_table_row(header_work, rndr, data, header_size, columns, col_data, MKD_TABLE_HEADER);
 
-			row_start = i;
+	if (in_place) {
+		rndr->cb.container_close(ob, MKD_CONTAINER_TABLE_HEADER, 0, part_mark, rndr->opaque);
+		part_mark = rndr->cb.container_open(ob, MKD_CONTAINER_TABLE_BODY, 0, rndr->opaque);
+	}
 
-			while (i < size && data[i] != '\n')
-				if (data[i++] == '|')
-					pipes++;
+	/* skipping the header and its underline */
+	if (line)
+		line += 2;
 
-			if (pipes == 0 || i == size) {
-				i = row_start;
-				break;
-			}
+	while (i < size) {
+		row_start = i;
 
-			parse_table_row(
-				body_work,
-				rndr,
-				data + row_start,
-				i - row_start,
-				columns,
-				col_data, 0
-			);
+		if (line) {
+			i = line->end - base - 1;
+			pipe = ((line++)->starts & BLOCK_TABLE) != 0;
+		} else {
+			end = memchr(data + i, '\n', size - i);
+			i = end ? (size_t)(end - data) : size;
+			pipe = memchr(data + row_start, '|', i - row_start) != NULL;
+		}
 
-			i++;
+		if (!pipe || i == size) {
+			i = row_start;
+			break;
 		}
 
-		if (rndr->cb.table)
-			rndr->cb.table(ob, header_work, body_work, rndr->opaque);
+		parse_table_row(body_work, rndr, data + row_start, i - row_start, columns, col_data, 0);
+		i++;
+	}
+
+	if (in_place) {
+		rndr->inplace_depth -= 2;
+		rndr->cb.container_close(ob, MKD_CONTAINER_TABLE_BODY, 0, part_mark, rndr->opaque);
+		rndr->cb.container_close(ob, MKD_CONTAINER_TABLE, 0, mark, rndr->opaque);
+		return i;
 	}
 
-	free(col_data);
+	if (rndr->cb.table)
+		rndr->cb.table(ob, header_work, body_work, rndr->opaque);
+
 	rndr_popbuf(rndr, BUFFER_SPAN);
 	rndr_popbuf(rndr, BUFFER_BLOCK);
 	return i;
 }
 
-/* parse_block • parsing of one block, returning next uint8_t to parse */
-static void
-parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+/* parse_next_block • parsing of the block at the start of data, returning its size */
+static size_t
+parse_next_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
 {
-	size_t beg, end, i;
-	uint8_t *txt_data;
-	beg = 0;
+	const struct line_info *line;
+	size_t i, indent = 0;
+	uint8_t starts;
 
-	if (rndr->work_bufs[BUFFER_SPAN].size +
-		rndr->work_bufs[BUFFER_BLOCK].size > rndr->max_nesting)
-		return;
+	if (is_atxheader(rndr, data, size))
+		return parse_atxheader(ob, rndr, data, size);
 
-	while (beg < size) {
-		txt_data = data + beg;
-		end = size - beg;
+	if (data[0] == '<' && rndr->cb.blockhtml &&
+			(i = parse_htmlblock(ob, rndr, data, size, 1)) != 0)
+		return i;
 
-		if (is_atxheader(rndr, txt_data, end))
-			beg += parse_atxheader(ob, rndr, txt_data, end);
+	/* only the parsers the first byte allows are tried, in the usual
+	 * order; four spaces make code, unless the line is blank */
+	if ((line = rndr_line(rndr, data)) != NULL)
+		starts = line->starts;
+	else {
+		while (indent < 4 && indent < size && data[indent] == ' ')
+			indent++;
 
-		else if (data[beg] == '<' && rndr->cb.blockhtml &&
-				(i = parse_htmlblock(ob, rndr, txt_data, end, 1)) != 0)
-			beg += i;
+		if (indent < 4 && indent < size)
+			starts = block_starts[data[indent]];
+		else
+			starts = BLOCK_EMPTY | BLOCK_CODE;
 
-		else if ((i = is_empty(txt_data, end)) != 0)
-			beg += i;
+		starts |= BLOCK_TABLE;
+	}
 
-		else if (is_hrule(txt_data, end)) {
-			if (rndr->cb.hrule)
-				rndr->cb.hrule(ob, rndr->opaque);
+	if ((starts & BLOCK_EMPTY) != 0 && (i = is_empty(data, size)) != 0)
+		return i;
 
-			while (beg < size && data[beg] != '\n')
-				beg++;
+	if ((starts & BLOCK_HRULE) != 0 && is_hrule(data, size)) {
+		if (rndr->cb.hrule)
+			rndr->cb.hrule(ob, rndr->opaque);
 
-			beg++;
-		}
+		i = 0;
+		while (i < size && data[i] != '\n')
+			i++;
+
+		return i + 1;
+	}
 
-		else if ((rndr->ext_flags & MKDEXT_FENCED_CODE) != 0 &&
-			(i = parse_fencedcode(ob, rndr, txt_data, end)) != 0)
-			beg += i;
+	if ((starts & BLOCK_FENCE) != 0 && (rndr->ext_flags & MKDEXT_FENCED_CODE) != 0 &&
+		(i = parse_fencedcode(ob, rndr, data, size)) != 0)
+		return i;
 
-		else if ((rndr->ext_flags & MKDEXT_TABLES) != 0 &&
-			(i = parse_table(ob, rndr, txt_data, end)) != 0)
-			beg += i;
+	if ((starts & BLOCK_TABLE) != 0 && (rndr->ext_flags & MKDEXT_TABLES) != 0 &&
+		(i = parse_table(ob, rndr, data, size)) != 0)
+		return i;
 
-		else if (prefix_quote(txt_data, end))
-			beg += parse_blockquote(ob, rndr, txt_data, end);
+	if ((starts & BLOCK_QUOTE) != 0) {
+		if (prefix_quote(data, size))
+			return parse_blockquote(ob, rndr, data, size);
 
-		else if (prefix_blockspoiler(txt_data, end))
-			beg += parse_blockspoiler(ob, rndr, txt_data, end);
+		if (prefix_blockspoiler(rndr, data, size))
+			return parse_blockspoiler(ob, rndr, data, size);
+	}
 
-		else if (prefix_code(txt_data, end))
-			beg += parse_blockcode(ob, rndr, txt_data, end);
+	if ((starts & BLOCK_CODE) != 0 && prefix_code(data, size))
+		return parse_blockcode(ob, rndr, data, size);
 
-		else if (prefix_uli(txt_data, end))
-			beg += parse_list(ob, rndr, txt_data, end, 0);
+	if ((starts & BLOCK_ULI) != 0 && prefix_uli(data, size))
+		return parse_list(ob, rndr, data, size, 0);
 
-		else if (prefix_oli(txt_data, end))
-			beg += parse_list(ob, rndr, txt_data, end, MKD_LIST_ORDERED);
+	if ((starts & BLOCK_OLI) != 0 && prefix_oli(data, size))
+		return parse_list(ob, rndr, data, size, MKD_LIST_ORDERED);
 
-		else
-			beg += parse_paragraph(ob, rndr, txt_data, end);
-	}
+	return parse_paragraph(ob, rndr, data, size);
+}
+
+/* parse_block • parsing of a sequence of blocks */
+static void
+parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+{
+	size_t beg = 0;
+	struct block_scan outer = rndr->spoiler_scan;
+
+	if (rndr_nesting(rndr) > rndr->max_nesting)
+		return;
+
+	reset_block_scan(rndr, data, size);
+
+	while (beg < size)
+		beg += parse_next_block(ob, rndr, data + beg, size - beg);
+
+	clear_block_scan(rndr);
+	rndr->spoiler_scan = outer;
 }
 
 
@@ -2495,7 +3658,7 @@ parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 
 /* is_ref • returns whether a line is a reference or not */
 static int
-is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_ref **refs)
+is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_refs *refs)
 {
 /*	int n; */
 	size_t i = 0;
@@ -2599,6 +3762,7 @@ is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_re
 		bufput(ref->label, data + id_offset, id_end - id_offset);
 		ref->link = bufnew(link_end - link_offset);
 		bufput(ref->link, data + link_offset, link_end - link_offset);
+		ref->source = link_offset;
 
 		if (title_end > title_offset) {
 			ref->title = bufnew(title_end - title_offset);
@@ -2609,31 +3773,6 @@ is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_re
 	return 1;
 }
 
-static void expand_tabs(struct buf *ob, const uint8_t *line, size_t size)
-{
-	size_t  i = 0, tab = 0;
-
-	while (i < size) {
-		size_t org = i;
-
-		while (i < size && line[i] != '\t') {
-			i++; tab++;
-		}
-
-		if (i > org)
-			bufput(ob, line + org, i - org);
-
-		if (i >= size)
-			break;
-
-		do {
-			bufputc(ob, ' '); tab++;
-		} while (tab % 4);
-
-		i++;
-	}
-}
-
 /**********************
  * EXPORTED FUNCTIONS *
  **********************/
@@ -2654,6 +3793,8 @@ sd_markdown_new(
 	if (!md)
 		return NULL;
 
+	sd_scan_init();
+
 	if (!sip_hash_key_init) {
 		if (getrandom(sip_hash_key, SIP_HASH_KEY_LEN, 0) < SIP_HASH_KEY_LEN)
 			return NULL;
@@ -2705,80 +3846,1000 @@ sd_markdown_new(
 	md->max_nesting = max_nesting;
 	md->max_table_cols = max_table_cols;
 	md->in_link_body = 0;
+	md->inplace_depth = 0;
+
+	md->lines = bufnew(64 * sizeof(struct line_info));
+	md->line_text = NULL;
+	md->line_text_size = 0;
+	md->line_next = 0;
+
+	md->table_cols = bufnew(16 * sizeof(int));
+	md->html_unclosed_count = 0;
+	memset(&md->spoiler_scan, 0, sizeof md->spoiler_scan);
+
+	init_link_refs(&md->refs);
+
+	md->span = NULL;
+	md->brackets = bufnew(64 * sizeof(struct bracket));
+	md->emph_states = bufnew(64 * sizeof(size_t));
+	md->emph_loops = bufnew(64 * sizeof(size_t));
+
+	md->track_source = 0;
+	md->source = NULL;
+	md->source_size = md->source_asize = 0;
+	md->link_source = SD_NO_SOURCE;
+	md->header_count = 0;
+	md->output_size = 0;
 
 	return md;
 }
 
-void
-sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+/* copied bytes counted by each output_size() call of the first pass */
+#define OUTPUT_COUNT_BLOCK	4096
+
+/* output_reserve • room to pre-grow for rendering size bytes of text
+ * whose counted output size is bound: the bound, capped at twice the text
+ * so a run of markup characters that rarely expand doesn't reserve many
+ * times its size (bufput grows the buffer past that as usual), plus the
+ * header and footer the renderer wraps around it */
+static size_t
+output_reserve(size_t bound, size_t size)
 {
-#define MARKDOWN_GROW(x) ((x) + ((x) >> 1))
-	static const char UTF8_BOM[] = {0xEF, 0xBB, 0xBF};
+	if (bound > size * 2)
+		bound = size * 2;
 
-	struct buf *text;
-	size_t beg, end;
+	return bound + 128;
+}
 
-	text = bufnew(64);
-	if (!text)
-		return;
+/* add_line • records the line of text ending at its last byte */
+static void
+add_line(struct buf *lines, struct buf *text, size_t beg)
+{
+	struct line_info line;
+	uint8_t *data = text->data + beg;
+	size_t size = text->size - beg, indent = 0;
+
+	while (indent < 4 && data[indent] == ' ')
+		indent++;
+
+	line.end = text->size;
+	line.starts = indent < 4 ? block_starts[data[indent]] : BLOCK_EMPTY | BLOCK_CODE;
+
+	if ((line.starts & BLOCK_EMPTY) != 0 && !is_empty(data, size))
+		line.starts &= ~BLOCK_EMPTY;
+	if ((line.starts & BLOCK_HRULE) != 0 && !is_hrule(data, size))
+		line.starts &= ~BLOCK_HRULE;
+	if ((line.starts & BLOCK_FENCE) != 0 && !prefix_codefence(data, size))
+		line.starts &= ~BLOCK_FENCE;
+	if (memchr(data, '|', size) != NULL)
+		line.starts |= BLOCK_TABLE;
+
+	bufput(lines, &line, sizeof line);
+}
 
-	/* Preallocate enough space for our buffer to avoid expanding while copying */
-	bufgrow(text, doc_size);
+/* grow_source • makes room for the offsets of `size` bytes of text */
+static int
+grow_source(struct sd_markdown *md, size_t size)
+{
+	uint32_t *source;
 
-	/* reset the references table */
-	memset(&md->refs, 0x0, REF_TABLE_SIZE * sizeof(void *));
+	if (size <= md->source_asize)
+		return 1;
 
-	/* first pass: looking for references, copying everything else */
-	beg = 0;
+	source = realloc(md->source, size * sizeof(uint32_t));
+	if (!source)
+		return 0;
+
+	md->source = source;
+	md->source_asize = size;
+	return 1;
+}
+
+/* add_source • records the document offsets of `size` more bytes of the
+ * copied text, counting up from `offset` */
+static inline void
+add_source(struct sd_markdown *md, size_t offset, size_t size)
+{
+	uint32_t *p;
+	size_t i;
+
+	if (md->source_size + size > md->source_asize &&
+		!grow_source(md, (md->source_size + size) * 2))
+		return;
+
+	p = md->source + md->source_size;
+	for (i = 0; i < size; ++i)
+		p[i] = (uint32_t)(offset + i);
+
+	md->source_size += size;
+}
 
-	/* Skip a possible UTF-8 BOM, even though the Unicode standard
-	 * discourages having these in UTF-8 documents */
-	if (doc_size >= 3 && memcmp(document, UTF8_BOM, 3) == 0)
-		beg += 3;
+/* copy_lines • first pass from document offset beg, which starts a line:
+ * looking for references, copying everything else and recording its lines
+ * in lines, until a line starts at or past stop. The document offset past
+ * each line and the span of each reference are appended to ends and
+ * ref_spans when given. Returns where it stopped. */
+static size_t
+copy_lines(struct buf *text, struct buf *lines, struct buf *ends, struct buf *ref_spans,
+	const uint8_t *document, size_t beg, size_t stop, size_t doc_size, struct sd_markdown *md)
+{
+	size_t end, copied, spaces, line_beg = text->size, bracket, counted = text->size;
+	size_t limit = stop + 3 < doc_size ? stop + 3 : doc_size, span[2];
+	const uint8_t *p;
+
+	/* a reference starts with a '[' after at most three spaces, so
+	 * is_ref only needs to see the lines with the next '[' that near,
+	 * and none past the last line start before stop */
+	p = memchr(document + beg, '[', limit - beg);
+	bracket = p ? (size_t)(p - document) : limit;
+
+	while (beg < stop && beg < doc_size) { /* iterating over lines */
+		if (bracket < beg) {
+			p = memchr(document + beg, '[', limit - beg);
+			bracket = p ? (size_t)(p - document) : limit;
+		}
 
-	while (beg < doc_size) /* iterating over lines */
-		if (is_ref(document, beg, doc_size, &end, md->refs))
+		if (bracket <= beg + 3 && is_ref(document, beg, doc_size, &end, &md->refs)) {
+			if (ref_spans) {
+				span[0] = beg;
+				span[1] = end;
+				bufput(ref_spans, span, sizeof span);
+			}
 			beg = end;
+		}
 		else { /* skipping to the next line */
+			/* copying the line body in blocks, expanding each tab to
+			 * the next multiple of four columns */
 			end = beg;
-			while (end < doc_size && document[end] != '\n' && document[end] != '\r')
-				end++;
+			while (1) {
+				copied = end + sd_scan->copy_end(document + end, doc_size - end);
+				if (copied > end) {
+					bufput(text, document + end, copied - end);
+					if (md->track_source)
+						add_source(md, end, copied - end);
+				}
 
-			/* adding the line body if present */
-			if (end > beg)
-				expand_tabs(text, document + beg, end - beg);
+				if (copied >= doc_size || document[copied] != '\t') {
+					end = copied;
+					break;
+				}
 
+				spaces = 4 - (text->size - line_beg) % 4;
+				bufput(text, "    ", spaces);
+
+				/* the spaces all come from the tab */
+				while (md->track_source && spaces--)
+					add_source(md, copied, 1);
+				end = copied + 1;
+			}
+
+			/* adding one \n per newline: a \n, a \r\n, or a \r before
+			 * anything but the end of the document */
 			while (end < doc_size && (document[end] == '\n' || document[end] == '\r')) {
-				/* add one \n per newline */
-				if (document[end] == '\n' || (end + 1 < doc_size && document[end + 1] != '\n'))
-					bufputc(text, '\n');
-				end++;
+				copied = end;
+				if (document[end++] == '\r') {
+					if (end >= doc_size)
+						break;
+					if (document[end] == '\n')
+						end++;
+				}
+
+				if (md->track_source)
+					add_source(md, copied, 1);
+				bufputc(text, '\n');
+				add_line(lines, text, line_beg);
+				if (ends)
+					bufput(ends, &end, sizeof end);
+				line_beg = text->size;
+			}
+
+			/* count the expected output of what was copied while it is
+			 * still in cache, in blocks long enough for the kernel */
+			if (text->size - counted >= OUTPUT_COUNT_BLOCK) {
+				md->output_size += sd_scan->output_size(text->data + counted, text->size - counted);
+				counted = text->size;
 			}
 
 			beg = end;
 		}
+	}
 
-	/* pre-grow the output buffer to minimize allocations */
-	bufgrow(ob, MARKDOWN_GROW(text->size));
+	/* adding a final newline if not already present */
+	if (beg >= doc_size && text->size > line_beg) {
+		if (md->track_source)
+			add_source(md, doc_size, 1);
+		bufputc(text, '\n');
+		add_line(lines, text, line_beg);
+		if (ends)
+			bufput(ends, &doc_size, sizeof doc_size);
+	}
+
+	md->output_size += sd_scan->output_size(text->data + counted, text->size - counted);
+	return beg;
+}
+
+/* copy_start • where the first pass starts: past a possible UTF-8 BOM,
+ * even though the Unicode standard discourages having these in UTF-8
+ * documents */
+static size_t
+copy_start(const uint8_t *document, size_t doc_size)
+{
+	static const char UTF8_BOM[] = {0xEF, 0xBB, 0xBF};
+
+	return doc_size >= 3 && memcmp(document, UTF8_BOM, 3) == 0 ? 3 : 0;
+}
+
+/* copy_document • first pass over the whole document */
+static void
+copy_document(struct buf *text, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+	/* Preallocate enough space for our buffer to avoid expanding while copying */
+	bufgrow(text, text->size + doc_size);
+
+	/* reset the references table */
+	init_link_refs(&md->refs);
+	md->lines->size = 0;
+	md->output_size = 0;
+	if (md->track_source) {
+		md->source_size = 0;
+		grow_source(md, doc_size + 1);
+	}
+
+	copy_lines(text, md->lines, NULL, NULL, document, copy_start(document, doc_size),
+		doc_size, doc_size, md);
+}
+
+void
+sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+	struct buf *text;
+
+	text = bufnew(64);
+	if (!text)
+		return;
+
+	copy_document(text, document, doc_size, md);
+
+	/* pre-grow the output buffer to its expected size, so it is
+	 * allocated once for nearly every document */
+	bufgrow(ob, ob->size + output_reserve(md->output_size, text->size));
 
 	/* second pass: actual rendering */
 	if (md->cb.doc_header)
 		md->cb.doc_header(ob, md->opaque);
 
-	if (text->size) {
-		/* adding a final newline if not already present */
-		if (text->data[text->size - 1] != '\n' &&  text->data[text->size - 1] != '\r')
-			bufputc(text, '\n');
+	md->line_text = text->data;
+	md->line_text_size = text->size;
+	md->line_next = 0;
+	md->html_unclosed_count = 0;
 
+	if (text->size)
 		parse_block(ob, md, text->data, text->size);
+
+	md->line_text = NULL;
+
+	if (md->cb.doc_footer)
+		md->cb.doc_footer(ob, md->opaque);
+
+	/* clean-up */
+	bufrelease(text);
+	free_link_refs(&md->refs);
+
+	assert(md->work_bufs[BUFFER_SPAN].size == 0);
+	assert(md->work_bufs[BUFFER_BLOCK].size == 0);
+}
+
+/*************************
+ * INCREMENTAL RENDERING *
+ *************************/
+
+/* A top-level block of the previous render: its span in the copied text,
+ * the span of its output and whether the output buffer was empty when it
+ * was rendered (block callbacks only separate blocks with a newline when
+ * something precedes them). Blocks flagged BLOCK_SCANS_AHEAD may look at
+ * text arbitrarily far past their end and are never reused when the edit
+ * follows them. Blocks flagged BLOCK_HAS_HEADER render headers, whose
+ * output may depend on how many headers came before. */
+#define BLOCK_FIRST_OUTPUT	1
+#define BLOCK_SCANS_AHEAD	2
+#define BLOCK_HAS_HEADER	4
+
+struct block_span {
+	size_t beg, end;
+	size_t out_beg, out_end;
+	unsigned int flags;
+};
+
+/* The cache also keeps the document and what the first pass made of it,
+ * so a new version only copies the lines around the edit: the text, its
+ * line table, the document offset past each line and the document span of
+ * each reference definition, which are read again into the table. */
+struct sd_block_cache {
+	const struct sd_markdown *md;
+	struct buf *doc;		/* document of the last render */
+	struct buf *text;		/* its copied text, before parsing */
+	struct buf *lines;		/* struct line_info of each line of text */
+	struct buf *ends;		/* document offset past each line of text */
+	struct buf *refs;		/* document span of each reference definition */
+	struct buf *work;		/* the copy of text the parser rewrites */
+	struct buf *out;		/* header and block output of the last render */
+	struct buf *blocks;		/* struct block_span of the last render */
+	size_t block_count;
+	size_t scans_ahead;		/* first block flagged BLOCK_SCANS_AHEAD */
+};
+
+struct sd_block_cache *
+sd_block_cache_new(void)
+{
+	struct sd_block_cache *cache;
+
+	cache = calloc(1, sizeof(struct sd_block_cache));
+	if (!cache)
+		return NULL;
+
+	cache->doc = bufnew(1024);
+	cache->text = bufnew(1024);
+	cache->lines = bufnew(64 * sizeof(struct line_info));
+	cache->ends = bufnew(64 * sizeof(size_t));
+	cache->refs = bufnew(64);
+	cache->work = bufnew(1024);
+	cache->out = bufnew(1024);
+	cache->blocks = bufnew(16 * sizeof(struct block_span));
+
+	return cache;
+}
+
+void
+sd_block_cache_free(struct sd_block_cache *cache)
+{
+	if (!cache)
+		return;
+
+	bufrelease(cache->doc);
+	bufrelease(cache->text);
+	bufrelease(cache->lines);
+	bufrelease(cache->ends);
+	bufrelease(cache->refs);
+	bufrelease(cache->work);
+	bufrelease(cache->out);
+	bufrelease(cache->blocks);
+	free(cache);
+}
+
+/* lines copied again before the first one the edit touches: a reference
+ * definition may read the two lines past its own */
+#define EDIT_LINES	4
+
+/* common_prefix • length of the common prefix of a and b */
+static size_t
+common_prefix(const uint8_t *a, const uint8_t *b, size_t size)
+{
+	size_t i = 0;
+
+	while (size - i >= 256 && memcmp(a + i, b + i, 256) == 0)
+		i += 256;
+
+	while (i < size && a[i] == b[i])
+		i++;
+
+	return i;
+}
+
+/* common_suffix • length of the common suffix of the size bytes before
+ * a_end and before b_end */
+static size_t
+common_suffix(const uint8_t *a_end, const uint8_t *b_end, size_t size)
+{
+	size_t i = 0;
+
+	while (size - i >= 256 && memcmp(a_end - i - 256, b_end - i - 256, 256) == 0)
+		i += 256;
+
+	while (i < size && *(a_end - i - 1) == *(b_end - i - 1))
+		i++;
+
+	return i;
+}
+
+/* ends_before • number of sorted offsets below off */
+static size_t
+ends_before(const size_t *ends, size_t count, size_t off)
+{
+	size_t lo = 0, hi = count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ends[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* lines_through • number of lines ending at or before off */
+static size_t
+lines_through(const struct line_info *lines, size_t count, size_t off)
+{
+	size_t lo = 0, hi = count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (lines[mid].end <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* splice_buf • replaces the bytes from beg to end of buf with data */
+static void
+splice_buf(struct buf *buf, size_t beg, size_t end, const void *data, size_t size)
+{
+	size_t tail = buf->size - end;
+
+	if (bufgrow(buf, beg + size + tail) < 0)
+		return;
+
+	if (tail)
+		memmove(buf->data + beg + size, buf->data + end, tail);
+	if (size)
+		memcpy(buf->data + beg, data, size);
+	buf->size = beg + size + tail;
+}
+
+/* copy_cached • first pass over the whole document, recording in the
+ * cache what a later version needs to copy only around its edit */
+static void
+copy_cached(struct sd_block_cache *cache, const uint8_t *document, size_t doc_size,
+	struct sd_markdown *md)
+{
+	free_link_refs(&md->refs);
+	cache->text->size = cache->lines->size = cache->ends->size = cache->refs->size = 0;
+	bufgrow(cache->text, doc_size);
+
+	copy_lines(cache->text, cache->lines, cache->ends, cache->refs, document,
+		copy_start(document, doc_size), doc_size, doc_size, md);
+
+	splice_buf(cache->doc, 0, cache->doc->size, document, doc_size);
+}
+
+/* recopy_edit • first pass over a new version of the cached document: the
+ * lines from a few before the first changed byte down to one that starts
+ * in the unchanged end are copied again and spliced into the cached text,
+ * and the references read again from their spans. Sets the length of the
+ * common prefix and suffix of the old and new text, and returns 0 when the
+ * edit may have changed a reference definition. */
+static int
+recopy_edit(struct sd_block_cache *cache, const uint8_t *document, size_t doc_size,
+	struct sd_markdown *md, size_t *prefix, size_t *suffix)
+{
+	struct buf *text, *lines, *ends, *refs;
+	const size_t *old_ends = (const size_t *)cache->ends->data;
+	const struct line_info *old_lines = (const struct line_info *)cache->lines->data;
+	const size_t (*old_refs)[2] = (const size_t (*)[2])cache->refs->data;
+	size_t line_count = cache->ends->size / sizeof(size_t);
+	size_t ref_count = cache->refs->size / sizeof old_refs[0];
+	size_t old_size = cache->doc->size, old_text_size = cache->text->size;
+	size_t head, tail, first, last, beg, end, old_end, text_beg, text_end, i, n;
+	struct line_info *line;
+	size_t *off;
+	int ok = 0;
+
+	n = old_size < doc_size ? old_size : doc_size;
+	head = common_prefix(document, cache->doc->data, n);
+	tail = common_suffix(document + doc_size, cache->doc->data + old_size, n - head);
+
+	/* the old lines kept before and after the copy, and where it starts */
+	first = ends_before(old_ends, line_count, head);
+	first = first > EDIT_LINES ? first - EDIT_LINES : 0;
+	beg = first ? old_ends[first - 1] : copy_start(document, doc_size);
+	text_beg = first ? old_lines[first - 1].end : 0;
+
+	text = bufnew(1024);
+	lines = bufnew(16 * sizeof(struct line_info));
+	ends = bufnew(16 * sizeof(size_t));
+	refs = bufnew(64);
+
+	/* copy on until a line starts where one started in the old version */
+	end = copy_lines(text, lines, ends, refs, document, beg, doc_size - tail, doc_size, md);
+	last = line_count;
+	while (end < doc_size) {
+		old_end = end + old_size - doc_size;
+		last = ends_before(old_ends, line_count, old_end);
+		if (last < line_count && old_ends[last] == old_end) {
+			last++;
+			break;
+		}
+
+		end = copy_lines(text, lines, ends, refs, document, end, end + 1, doc_size, md);
+		last = line_count;
+	}
+
+	old_end = end + old_size - doc_size;
+	text_end = last ? old_lines[last - 1].end : 0;
+	if (end >= doc_size) {
+		old_end = old_size;
+		text_end = old_text_size;
 	}
 
+	/* the references must all lie outside the copy, in both versions */
+	if (refs->size)
+		goto cleanup;
+
+	for (i = 0; i < ref_count; ++i)
+		if (old_refs[i][1] > beg && old_refs[i][0] < old_end)
+			goto cleanup;
+
+	/* how much of the old and new text is the same */
+	n = text_end - text_beg < text->size ? text_end - text_beg : text->size;
+	i = common_prefix(text->data, cache->text->data + text_beg, n);
+	*prefix = text_beg + i;
+	*suffix = old_text_size - text_end +
+		common_suffix(text->data + text->size, cache->text->data + text_end, n - i);
+	if (i == text->size && i == text_end - text_beg)
+		*prefix = old_text_size;
+
+	/* splice the copy in and move what follows it */
+	for (i = 0, line = (struct line_info *)lines->data; i < lines->size / sizeof *line; ++i)
+		line[i].end += text_beg;
+
+	splice_buf(cache->text, text_beg, text_end, text->data, text->size);
+	splice_buf(cache->lines, first * sizeof *line, last * sizeof *line, lines->data, lines->size);
+	splice_buf(cache->ends, first * sizeof(size_t), last * sizeof(size_t), ends->data, ends->size);
+	splice_buf(cache->doc, head, old_size - tail, document + head, doc_size - tail - head);
+
+	line = (struct line_info *)cache->lines->data;
+	n = cache->lines->size / sizeof *line;
+	for (i = first + lines->size / sizeof *line; i < n; ++i)
+		line[i].end = line[i].end + cache->text->size - old_text_size;
+
+	off = (size_t *)cache->ends->data;
+	for (i = first + ends->size / sizeof(size_t); i < n; ++i)
+		off[i] = off[i] + doc_size - old_size;
+
+	off = (size_t *)cache->refs->data;
+	for (i = 0; i < ref_count; ++i) {
+		if (off[2 * i] >= old_end) {
+			off[2 * i] = off[2 * i] + doc_size - old_size;
+			off[2 * i + 1] = off[2 * i + 1] + doc_size - old_size;
+		}
+		is_ref(document, off[2 * i], doc_size, &end, &md->refs);
+	}
+
+	ok = 1;
+
+cleanup:
+	bufrelease(text);
+	bufrelease(lines);
+	bufrelease(ends);
+	bufrelease(refs);
+	return ok;
+}
+
+/* block_lookahead_end • end of the text a block may inspect past its own
+ * end: any following blank lines and the next two lines */
+static size_t
+block_lookahead_end(uint8_t *data, size_t beg, size_t size)
+{
+	size_t i, lines = 0;
+
+	while (beg < size && (i = is_empty(data + beg, size - beg)) != 0)
+		beg += i;
+
+	while (beg < size && lines < 2) {
+		while (beg < size && data[beg] != '\n')
+			beg++;
+		beg++;
+		lines++;
+	}
+
+	return beg < size ? beg : size;
+}
+
+/* block_scans_ahead • whether a block contains a construct whose
+ * recognition searches the rest of the document */
+static int
+block_scans_ahead(struct sd_markdown *md, const uint8_t *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < size; ++i) {
+		if (data[i] == '>' && data[i + 1] == '!')
+			return 1;
+		if (data[i] == '<' && md->cb.blockhtml)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* render_next_block • renders one top-level block of the working copy
+ * and records its span */
+static size_t
+render_next_block(struct buf *out, struct buf *blocks, struct sd_markdown *md,
+	const uint8_t *text, uint8_t *work, size_t beg, size_t size)
+{
+	struct block_span span;
+
+	span.beg = beg;
+	span.out_beg = out->size;
+	span.flags = out->size ? 0 : BLOCK_FIRST_OUTPUT;
+
+	/* a table header on the last line may count the byte past it */
+	span.end = beg + parse_next_block(out, md, work + beg, size - beg);
+	if (span.end > size)
+		span.end = size;
+	span.out_end = out->size;
+
+	if (block_scans_ahead(md, text + span.beg, span.end - span.beg))
+		span.flags |= BLOCK_SCANS_AHEAD;
+
+	bufput(blocks, &span, sizeof span);
+	return span.end;
+}
+
+void
+sd_markdown_render_cached(struct buf *ob, const uint8_t *document, size_t doc_size,
+	struct sd_markdown *md, struct sd_block_cache *cache)
+{
+	struct buf *text, *work, *out, *blocks, *lines;
+	const struct block_span *old;
+	struct block_span *span;
+	size_t old_count, old_text_size, reused, i, n, beg, lo, hi;
+	size_t prefix = 0, suffix = 0;
+	int incremental, track_source;
+
+	out = bufnew(1024);
+	blocks = bufnew(16 * sizeof(struct block_span));
+
+	/* the first pass records into the cache, and the source of the
+	 * copied text isn't tracked */
+	lines = md->lines;
+	md->lines = cache->lines;
+	track_source = md->track_source;
+	md->track_source = 0;
+	md->source_size = 0;
+	md->output_size = 0;
+
+	old = (const struct block_span *)cache->blocks->data;
+	old_count = cache->block_count;
+	old_text_size = cache->text->size;
+
+	/* any change to the reference definitions may affect every link */
+	incremental = (cache->md == md && recopy_edit(cache, document, doc_size, md, &prefix, &suffix));
+	if (!incremental)
+		copy_cached(cache, document, doc_size, md);
+
+	text = cache->text;
+	work = cache->work;
+
+	if (md->cb.doc_header)
+		md->cb.doc_header(out, md->opaque);
+
+	/* blocks whose text and lookahead precede the edit render unchanged:
+	 * the text they looked at is the same, and so is where it ends */
+	reused = 0;
+	beg = 0;
+	if (incremental && out->size == (old_count ? old[0].out_beg : cache->out->size) &&
+		(out->size == 0 || memcmp(out->data, cache->out->data, out->size) == 0)) {
+		lo = 0;
+		hi = cache->scans_ahead;
+		if (prefix == text->size && prefix == old_text_size)
+			lo = hi;
+
+		while (lo < hi) {
+			n = hi - (hi - lo) / 2;
+			if (block_lookahead_end(text->data, old[n - 1].end, text->size) < prefix)
+				lo = n;
+			else
+				hi = n - 1;
+		}
+		reused = lo;
+
+		if (reused) {
+			bufput(out, cache->out->data + old[0].out_beg, old[reused - 1].out_end - old[0].out_beg);
+			bufput(blocks, old, reused * sizeof(struct block_span));
+			beg = old[reused - 1].end;
+		}
+	} else
+		incremental = 0;
+
+	/* the parser rewrites block contents in place, so it renders a copy
+	 * of what follows the reused blocks */
+	bufgrow(work, text->size);
+	if (text->size > beg)
+		memcpy(work->data + beg, text->data + beg, text->size - beg);
+	work->size = text->size;
+
+	md->line_text = work->data;
+	md->line_text_size = work->size;
+	md->line_next = lines_through((const struct line_info *)md->lines->data,
+		md->lines->size / sizeof(struct line_info), beg);
+	md->html_unclosed_count = 0;
+
+	/* re-parse until we land on an old block boundary past the edit */
+	reset_block_scan(md, work->data, work->size);
+	i = reused;
+	while (beg < work->size) {
+		if (incremental && beg >= text->size - suffix) {
+			size_t old_beg = beg + old_text_size - text->size;
+
+			while (i < old_count && old[i].beg < old_beg)
+				i++;
+
+			if (i < old_count && old[i].beg == old_beg &&
+				((old[i].flags & BLOCK_FIRST_OUTPUT) != 0) == (out->size == 0))
+				break;
+		}
+
+		beg = render_next_block(out, blocks, md, text->data, work->data, beg, work->size);
+	}
+	clear_block_scan(md);
+	md->line_text = NULL;
+
+	/* the remaining blocks only moved */
+	if (beg < work->size && i < old_count) {
+		n = blocks->size / sizeof(struct block_span);
+		bufput(blocks, old + i, (old_count - i) * sizeof(struct block_span));
+		bufput(out, cache->out->data + old[i].out_beg, old[old_count - 1].out_end - old[i].out_beg);
+
+		span = (struct block_span *)blocks->data;
+		for (; n < blocks->size / sizeof(struct block_span); ++n) {
+			span[n].beg = span[n].beg + text->size - old_text_size;
+			span[n].end = span[n].end + text->size - old_text_size;
+			span[n].out_beg = span[n].out_beg + out->size - cache->out->size;
+			span[n].out_end = span[n].out_end + out->size - cache->out->size;
+		}
+	}
+
+	bufput(ob, out->data, out->size);
+	if (md->cb.doc_footer)
+		md->cb.doc_footer(ob, md->opaque);
+
+	/* keep this version for the next render */
+	bufrelease(cache->out);
+	bufrelease(cache->blocks);
+
+	cache->md = md;
+	cache->out = out;
+	cache->blocks = blocks;
+	cache->block_count = blocks->size / sizeof(struct block_span);
+
+	span = (struct block_span *)blocks->data;
+	for (i = 0; i < cache->block_count && (span[i].flags & BLOCK_SCANS_AHEAD) == 0; ++i);
+	cache->scans_ahead = i;
+
+	md->lines = lines;
+	md->track_source = track_source;
+	free_link_refs(&md->refs);
+
+	assert(md->work_bufs[BUFFER_SPAN].size == 0);
+	assert(md->work_bufs[BUFFER_BLOCK].size == 0);
+}
+
+/**********************
+ * PARALLEL RENDERING *
+ **********************/
+
+/* Top-level blocks only share the reference table, so a document can be
+ * cut at top-level block boundaries and the parts rendered by separate
+ * parsers. The cuts are guessed cheaply (a line starting with a letter
+ * right after a blank line), and every part renders a private copy of its
+ * text plus PARALLEL_WINDOW bytes of what follows, recording its blocks.
+ * Blocks are then taken in document order from the part that rendered them
+ * only where they start exactly where the output so far stops, could
+ * not have looked past the window and render no headers (the renderer may
+ * number those); anything else is re-rendered serially, so the output is
+ * always that of sd_markdown_render.
+ *
+ * The threads are started per call rather than pooled: the parallel path
+ * only runs on documents of several PARALLEL_MIN_PART, where starting and
+ * joining a thread (some 20us) is lost in milliseconds of rendering, and
+ * workers kept between calls would not survive the fork() of preforking
+ * servers that load the module before forking. */
+#define PARALLEL_MIN_PART	(64 * 1024)
+#define PARALLEL_WINDOW		(16 * 1024)
+
+struct render_part {
+	struct sd_markdown *md;
+	const uint8_t *text;	/* the whole copied document */
+	size_t text_size;
+	size_t beg, end;		/* the span of this part */
+	struct buf *ob;
+	struct buf *blocks;		/* struct block_span */
+	pthread_t thread;
+};
+
+/* next_part_start • first likely top-level block boundary at or after beg */
+static size_t
+next_part_start(const uint8_t *text, size_t beg, size_t size)
+{
+	if (beg < 2)
+		beg = 2;
+
+	for (; beg < size; ++beg) {
+		if (text[beg - 1] == '\n' && text[beg - 2] == '\n' &&
+			(text[beg] | 0x20) >= 'a' && (text[beg] | 0x20) <= 'z')
+			return beg;
+	}
+
+	return size;
+}
+
+/* render_part • renders the blocks of one part of the document */
+static void *
+render_part(void *arg)
+{
+	struct render_part *part = arg;
+	struct block_span span;
+	struct buf *work;
+	size_t pos, window, headers;
+
+	window = part->end + PARALLEL_WINDOW;
+	if (window > part->text_size)
+		window = part->text_size;
+
+	work = bufnew(window - part->beg);
+	bufput(work, part->text + part->beg, window - part->beg);
+
+	/* the part is rendered as if something preceded it */
+	bufputc(part->ob, '\n');
+
+	reset_block_scan(part->md, work->data, window - part->beg);
+
+	pos = part->beg;
+	while (pos < part->end) {
+		span.beg = pos;
+		span.out_beg = part->ob->size;
+		headers = part->md->header_count;
+		span.end = pos + parse_next_block(part->ob, part->md,
+			work->data + pos - part->beg, window - pos);
+		span.out_end = part->ob->size;
+		span.flags = (part->md->header_count != headers) ? BLOCK_HAS_HEADER : 0;
+
+		if (block_scans_ahead(part->md, part->text + span.beg, span.end - span.beg) ||
+			(window < part->text_size &&
+			block_lookahead_end((uint8_t *)part->text, span.end, window) >= window))
+			span.flags |= BLOCK_SCANS_AHEAD;
+
+		bufput(part->blocks, &span, sizeof span);
+		pos = span.end;
+	}
+
+	clear_block_scan(part->md);
+
+	bufrelease(work);
+	return NULL;
+}
+
+void
+sd_markdown_render_parallel(struct buf *ob, const uint8_t *document, size_t doc_size,
+	struct sd_markdown **mds, size_t md_count)
+{
+	struct sd_markdown *md = mds[0];
+	struct render_part *parts;
+	struct buf *text;
+	size_t part_count, i, j, k, beg, pos;
+
+	text = bufnew(64);
+	if (!text)
+		return;
+
+	copy_document(text, document, doc_size, md);
+
+	part_count = text->size / PARALLEL_MIN_PART;
+	if (part_count > md_count)
+		part_count = md_count;
+	if (part_count < 1)
+		part_count = 1;
+
+	parts = calloc(part_count, sizeof(struct render_part));
+	if (!parts) {
+		bufrelease(text);
+		free_link_refs(&md->refs);
+		return;
+	}
+
+	/* cut the document and start the parts after the first */
+	for (i = 0, k = 0, beg = 0; i < part_count; ++i) {
+		size_t end = (i + 1 == part_count) ? text->size :
+			next_part_start(text->data, text->size / part_count * (i + 1), text->size);
+
+		if (end <= beg)
+			continue;
+
+		parts[k].md = mds[k];
+		parts[k].text = text->data;
+		parts[k].text_size = text->size;
+		parts[k].beg = beg;
+		parts[k].end = end;
+
+		if (k > 0) {
+			parts[k].md->refs = md->refs;
+			parts[k].ob = bufnew(64);
+			parts[k].blocks = bufnew(64 * sizeof(struct block_span));
+			/* a part only needs room for its share of the output */
+			bufgrow(parts[k].ob, output_reserve((size_t)((uint64_t)md->output_size *
+				(end - beg) / text->size), end - beg));
+
+			if (pthread_create(&parts[k].thread, NULL, render_part, &parts[k]) != 0) {
+				bufrelease(parts[k].ob);
+				bufrelease(parts[k].blocks);
+				parts[k].ob = parts[k].blocks = NULL;
+			}
+		}
+
+		beg = end;
+		k++;
+	}
+	part_count = k;
+
+	bufgrow(ob, ob->size + output_reserve(md->output_size, text->size));
+
+	if (md->cb.doc_header)
+		md->cb.doc_header(ob, md->opaque);
+
+	/* the first part renders in place while the others run */
+	reset_block_scan(md, text->data, text->size);
+	pos = 0;
+	while (part_count && pos < parts[0].end)
+		pos += parse_next_block(ob, md, text->data + pos, text->size - pos);
+
+	for (k = 1; k < part_count; ++k)
+		if (parts[k].ob)
+			pthread_join(parts[k].thread, NULL);
+
+	for (k = 1; k < part_count; ++k) {
+		struct render_part *part = &parts[k];
+		const struct block_span *blocks = NULL;
+		size_t block_count = 0;
+
+		if (part->blocks) {
+			blocks = (const struct block_span *)part->blocks->data;
+			block_count = part->blocks->size / sizeof(struct block_span);
+		}
+
+		i = 0;
+		while (pos < part->end) {
+			while (i < block_count && blocks[i].beg < pos)
+				i++;
+
+			if (i == block_count || blocks[i].beg != pos ||
+				(blocks[i].flags & (BLOCK_SCANS_AHEAD | BLOCK_HAS_HEADER)) != 0 || ob->size == 0) {
+				pos += parse_next_block(ob, md, text->data + pos, text->size - pos);
+				continue;
+			}
+
+			/* take the run of blocks the part vouches for */
+			for (j = i; j < block_count &&
+				(blocks[j].flags & (BLOCK_SCANS_AHEAD | BLOCK_HAS_HEADER)) == 0; ++j);
+
+			bufput(ob, part->ob->data + blocks[i].out_beg, blocks[j - 1].out_end - blocks[i].out_beg);
+
+			pos = blocks[j - 1].end;
+			i = j;
+		}
+	}
+
+	clear_block_scan(md);
+
 	if (md->cb.doc_footer)
 		md->cb.doc_footer(ob, md->opaque);
 
 	/* clean-up */
+	for (k = 1; k < part_count; ++k) {
+		init_link_refs(&parts[k].md->refs);
+		bufrelease(parts[k].ob);
+		bufrelease(parts[k].blocks);
+	}
+
+	free(parts);
 	bufrelease(text);
-	free_link_refs(md->refs);
+	free_link_refs(&md->refs);
 
 	assert(md->work_bufs[BUFFER_SPAN].size == 0);
 	assert(md->work_bufs[BUFFER_BLOCK].size == 0);
@@ -2798,9 +4859,32 @@ sd_markdown_free(struct sd_markdown *md)
 	stack_free(&md->work_bufs[BUFFER_SPAN]);
 	stack_free(&md->work_bufs[BUFFER_BLOCK]);
 
+	bufrelease(md->lines);
+	bufrelease(md->table_cols);
+	bufrelease(md->brackets);
+	bufrelease(md->emph_states);
+	bufrelease(md->emph_loops);
+	free(md->source);
 	free(md);
 }
 
+void
+sd_markdown_track_source(struct sd_markdown *md, int enabled)
+{
+	md->track_source = enabled;
+	if (!enabled) {
+		free(md->source);
+		md->source = NULL;
+		md->source_size = md->source_asize = 0;
+	}
+}
+
+size_t
+sd_markdown_link_source(const struct sd_markdown *md)
+{
+	return md->link_source;
+}
+
 void
 sd_version(int *ver_major, int *ver_minor, int *ver_revision)
 {
@@ -42,6 +42,20 @@ enum mkd_autolink {
 	MKDA_EMAIL,			/* e-mail link without explit mailto: */
 };
 
+/* mkd_container - blocks whose children container_open and
+ * container_close render in place */
+enum mkd_container {
+	MKD_CONTAINER_BLOCKQUOTE,
+	MKD_CONTAINER_BLOCKSPOILER,
+	MKD_CONTAINER_LIST,
+	MKD_CONTAINER_LISTITEM,
+	MKD_CONTAINER_TABLE,
+	MKD_CONTAINER_TABLE_HEADER,	/* the header row */
+	MKD_CONTAINER_TABLE_BODY,	/* the other rows */
+	MKD_CONTAINER_TABLE_ROW,	/* flags: MKD_TABLE_HEADER */
+	MKD_CONTAINER_TABLE_CELL,	/* flags: mkd_tableflags */
+};
+
 enum mkd_tableflags {
 	MKD_TABLE_ALIGN_L = 1,
 	MKD_TABLE_ALIGN_R = 2,
@@ -100,9 +114,17 @@ struct sd_callbacks {
 	/* header and footer */
 	void (*doc_header)(struct buf *ob, void *opaque);
 	void (*doc_footer)(struct buf *ob, void *opaque);
+
+	/* container hooks - when set, they replace blockquote, blockspoiler,
+	 * list and listitem: the children render straight into ob between
+	 * the two calls, and container_close gets back the value its
+	 * container_open returned */
+	size_t (*container_open)(struct buf *ob, enum mkd_container type, int flags, void *opaque);
+	void (*container_close)(struct buf *ob, enum mkd_container type, int flags, size_t mark, void *opaque);
 };
 
 struct sd_markdown;
+struct sd_block_cache;
 
 /*********
  * FLAGS *
@@ -130,6 +152,44 @@ sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, str
 extern void
 sd_markdown_free(struct sd_markdown *md);
 
+/* sd_markdown_track_source • makes sd_markdown_render remember where each
+ * byte of the text it parses came from, at a cost of a uint32_t per byte */
+extern void
+sd_markdown_track_source(struct sd_markdown *md, int enabled);
+
+/* sd_markdown_link_source • offset in the document of the target of the
+ * link, image or autolink whose callback is running, or SD_NO_SOURCE when
+ * sources aren't tracked or the target isn't there */
+#define SD_NO_SOURCE ((size_t)-1)
+
+extern size_t
+sd_markdown_link_source(const struct sd_markdown *md);
+
+/* sd_markdown_render_cached • renders a new version of the document last
+ * rendered with the same cache, copying only the lines around the edit and
+ * re-parsing only the top-level blocks it touches. An edit to a reference
+ * definition renders the whole document again. The renderer options must
+ * not change between versions. */
+extern void
+sd_markdown_render_cached(struct buf *ob, const uint8_t *document, size_t doc_size,
+	struct sd_markdown *md, struct sd_block_cache *cache);
+
+/* sd_markdown_render_parallel • renders a large document with each of the
+ * md_count parsers rendering a share of its top-level blocks on its own
+ * thread. The parsers must share extensions and callbacks but have their
+ * own opaque data. Blocks that render headers are always rendered by
+ * mds[0], in document order, so renderer state such as header numbering
+ * stays that of a serial render. */
+extern void
+sd_markdown_render_parallel(struct buf *ob, const uint8_t *document, size_t doc_size,
+	struct sd_markdown **mds, size_t md_count);
+
+extern struct sd_block_cache *
+sd_block_cache_new(void);
+
+extern void
+sd_block_cache_free(struct sd_block_cache *cache);
+
 extern void
 sd_version(int *major, int *minor, int *revision);
 
@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2015, reddit inc.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* bytes houdini_escape_html0() rewrites (" & ' / < >) or drops (control
+ * characters other than \t, \n and \r) */
+static const uint8_t HTML_ESCAPE_SET[256] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	0, 0, 1, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 1,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0,
+};
+
+/* output_size() allowances: 5 for the bytes escaping expands the most
+ * (" & ' / < >, up to "&quot;") and for newlines (up to "<br/>\n"), 16
+ * for the markup characters that open tag pairs, table cells and
+ * autolinks (# * : @ [ ^ _ ` | ~) */
+#define ESCAPE_ALLOWANCE 5
+#define MARKUP_ALLOWANCE 16
+
+static const uint8_t OUTPUT_ALLOWANCE[256] = {
+	0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  5,  0,  0,  0,  0,  0,
+	0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	0,  0,  5, 16,  0,  0,  5,  5,  0,  0, 16,  0,  0,  0,  0,  5,
+	0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 16,  0,  5,  0,  5,  0,
+	16, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 16,  0,  0, 16, 16,
+	16, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+	0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 16,  0, 16,  0,
+};
+
+/******************
+ * SCALAR KERNELS *
+ ******************/
+
+static size_t
+copy_end_scalar(const uint8_t *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size && data[i] != '\n' && data[i] != '\r' && data[i] != '\t')
+		i++;
+
+	return i;
+}
+
+static size_t
+html_escape_scalar(const uint8_t *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < size && HTML_ESCAPE_SET[data[i]] == 0)
+		i++;
+
+	return i;
+}
+
+static size_t
+output_size_scalar(const uint8_t *data, size_t size)
+{
+	size_t i, total = size;
+
+	for (i = 0; i < size; i++)
+		total += OUTPUT_ALLOWANCE[data[i]];
+
+	return total;
+}
+
+static const struct sd_scan_kernels scan_scalar = {
+	SD_CPU_SCALAR, "scalar", copy_end_scalar, html_escape_scalar, output_size_scalar
+};
+
+#ifdef SCAN_X86
+
+/****************
+ * SSE2 KERNELS *
+ ****************/
+
+__attribute__((target("sse2")))
+static size_t
+copy_end_sse2(const uint8_t *data, size_t size)
+{
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i tab = _mm_set1_epi8('\t');
+	size_t i;
+	int mask;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+			_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)), _mm_cmpeq_epi8(v, tab)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + copy_end_scalar(data + i, size - i);
+}
+
+/* '&' and '\'' differ only in the lowest bit, '<' and '>' in the second
+ * lowest, so four comparisons cover the six escaped characters */
+__attribute__((target("sse2")))
+static size_t
+html_escape_sse2(const uint8_t *data, size_t size)
+{
+	const __m128i amp_apos = _mm_set1_epi8('\''), bit0 = _mm_set1_epi8(1);
+	const __m128i lt_gt = _mm_set1_epi8('>'), bit1 = _mm_set1_epi8(2);
+	const __m128i quot = _mm_set1_epi8('"'), slash = _mm_set1_epi8('/');
+	const __m128i ctrl_max = _mm_set1_epi8(0x1F);
+	const __m128i tab = _mm_set1_epi8('\t'), nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+	size_t i;
+	int mask;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i special, ctrl, space;
+
+		special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(_mm_or_si128(v, bit0), amp_apos),
+				_mm_cmpeq_epi8(_mm_or_si128(v, bit1), lt_gt)),
+			_mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, slash)));
+
+		ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl_max), ctrl_max);
+		space = _mm_or_si128(_mm_cmpeq_epi8(v, tab),
+			_mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)));
+
+		mask = _mm_movemask_epi8(_mm_or_si128(special, _mm_andnot_si128(space, ctrl)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + html_escape_scalar(data + i, size - i);
+}
+
+/* sum of the bytes of a vector of per-lane counters */
+__attribute__((target("sse2")))
+static size_t
+hsum_epu8_sse2(__m128i v)
+{
+	__m128i sad = _mm_sad_epu8(v, _mm_setzero_si128());
+
+	return (size_t)_mm_cvtsi128_si32(sad) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+}
+
+/* every lane counts its escaped bytes and markup characters separately,
+ * and is flushed before it can wrap at 255; '^' and '~', as well as '@'
+ * and '`', differ only in bit 5 */
+__attribute__((target("sse2")))
+static size_t
+output_size_sse2(const uint8_t *data, size_t size)
+{
+	const __m128i amp_apos = _mm_set1_epi8('\''), bit0 = _mm_set1_epi8(1);
+	const __m128i lt_gt = _mm_set1_epi8('>'), bit1 = _mm_set1_epi8(2);
+	const __m128i quot = _mm_set1_epi8('"'), slash = _mm_set1_epi8('/'), nl = _mm_set1_epi8('\n');
+	const __m128i hash = _mm_set1_epi8('#'), star = _mm_set1_epi8('*'), colon = _mm_set1_epi8(':');
+	const __m128i bracket = _mm_set1_epi8('['), under = _mm_set1_epi8('_'), pipe = _mm_set1_epi8('|');
+	const __m128i caret_tilde = _mm_set1_epi8('~'), at_tick = _mm_set1_epi8('`'), bit5 = _mm_set1_epi8(0x20);
+	size_t i = 0, escapes = 0, markup = 0;
+
+	while (i + 16 <= size) {
+		__m128i esc_acc = _mm_setzero_si128(), markup_acc = _mm_setzero_si128();
+		int n;
+
+		for (n = 0; n < 255 && i + 16 <= size; n++, i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+			__m128i v5 = _mm_or_si128(v, bit5), esc, mark;
+
+			esc = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(_mm_or_si128(v, bit0), amp_apos),
+					_mm_cmpeq_epi8(_mm_or_si128(v, bit1), lt_gt)),
+				_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, slash)),
+					_mm_cmpeq_epi8(v, nl)));
+
+			mark = _mm_or_si128(
+				_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(v, hash), _mm_cmpeq_epi8(v, star)),
+					_mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, bracket))),
+				_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(v, under), _mm_cmpeq_epi8(v, pipe)),
+					_mm_or_si128(_mm_cmpeq_epi8(v5, caret_tilde), _mm_cmpeq_epi8(v5, at_tick))));
+
+			/* the masks are -1 where they match */
+			esc_acc = _mm_sub_epi8(esc_acc, esc);
+			markup_acc = _mm_sub_epi8(markup_acc, mark);
+		}
+
+		escapes += hsum_epu8_sse2(esc_acc);
+		markup += hsum_epu8_sse2(markup_acc);
+	}
+
+	return i + escapes * ESCAPE_ALLOWANCE + markup * MARKUP_ALLOWANCE +
+		output_size_scalar(data + i, size - i);
+}
+
+static const struct sd_scan_kernels scan_sse2 = {
+	SD_CPU_SSE2, "sse2", copy_end_sse2, html_escape_sse2, output_size_sse2
+};
+
+/******************
+ * SSE4.2 KERNELS *
+ ******************/
+
+/* the escape set as byte ranges for PCMPESTRI */
+__attribute__((target("sse4.2")))
+static size_t
+html_escape_sse42(const uint8_t *data, size_t size)
+{
+	static const uint8_t ranges[16] = {
+		0x00, 0x08, 0x0B, 0x0C, 0x0E, 0x1F,
+		'"', '"', '&', '\'', '/', '/', '<', '<', '>', '>'
+	};
+	const __m128i set = _mm_loadu_si128((const __m128i *)ranges);
+	size_t i;
+	int idx;
+
+	for (i = 0; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+
+		idx = _mm_cmpestri(set, 16, v, 16,
+			_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+		if (idx < 16)
+			return i + idx;
+	}
+
+	return i + html_escape_scalar(data + i, size - i);
+}
+
+/* output_size() classifies each byte with two PSHUFB lookups, one per
+ * nibble. Every bit stands for one high nibble and a set of low
+ * nibbles, so a byte is in a class when both lookups share one of its
+ * bits:
+ *
+ *   bit 0: \n          bit 3: # *      bit 6: [ ^ _
+ *   bit 1: " & ' /     bit 4: :        bit 7: | ~
+ *   bit 2: < >         bit 5: @ `
+ */
+#define NIBBLE_ESCAPE 0x07
+#define NIBBLE_MARKUP 0xF8
+
+static const uint8_t OUTPUT_NIBBLE_LO[16] = {
+	0x20, 0, 0x02, 0x08, 0, 0, 0x02, 0x02, 0, 0, 0x19, 0x40, 0x84, 0, 0xC4, 0x42
+};
+
+static const uint8_t OUTPUT_NIBBLE_HI[16] = {
+	0x01, 0, 0x0A, 0x14, 0x20, 0x40, 0x20, 0x80, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+__attribute__((target("sse4.2")))
+static size_t
+output_size_sse42(const uint8_t *data, size_t size)
+{
+	const __m128i lo_set = _mm_loadu_si128((const __m128i *)OUTPUT_NIBBLE_LO);
+	const __m128i hi_set = _mm_loadu_si128((const __m128i *)OUTPUT_NIBBLE_HI);
+	const __m128i nibble = _mm_set1_epi8(0x0F), one = _mm_set1_epi8(1);
+	const __m128i esc_bits = _mm_set1_epi8(NIBBLE_ESCAPE);
+	const __m128i markup_bits = _mm_set1_epi8((char)NIBBLE_MARKUP);
+	size_t i = 0, escapes = 0, markup = 0;
+
+	while (i + 16 <= size) {
+		__m128i esc_acc = _mm_setzero_si128(), markup_acc = _mm_setzero_si128();
+		int n;
+
+		for (n = 0; n < 255 && i + 16 <= size; n++, i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+			__m128i kind = _mm_and_si128(
+				_mm_shuffle_epi8(lo_set, _mm_and_si128(v, nibble)),
+				_mm_shuffle_epi8(hi_set, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+
+			esc_acc = _mm_add_epi8(esc_acc, _mm_min_epu8(_mm_and_si128(kind, esc_bits), one));
+			markup_acc = _mm_add_epi8(markup_acc, _mm_min_epu8(_mm_and_si128(kind, markup_bits), one));
+		}
+
+		escapes += hsum_epu8_sse2(esc_acc);
+		markup += hsum_epu8_sse2(markup_acc);
+	}
+
+	return i + escapes * ESCAPE_ALLOWANCE + markup * MARKUP_ALLOWANCE +
+		output_size_scalar(data + i, size - i);
+}
+
+/* PCMPESTRI has nothing over two comparisons for the line scan */
+static const struct sd_scan_kernels scan_sse42 = {
+	SD_CPU_SSE42, "sse4.2", copy_end_sse2, html_escape_sse42, output_size_sse42
+};
+
+/****************
+ * AVX2 KERNELS *
+ ****************/
+
+__attribute__((target("avx2")))
+static size_t
+copy_end_avx2(const uint8_t *data, size_t size)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	size_t i;
+	unsigned int mask;
+
+	for (i = 0; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+
+		mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(
+			_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)), _mm256_cmpeq_epi8(v, tab)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	/* legacy SSE code after dirty upper halves stalls on the transition */
+	_mm256_zeroupper();
+	return i + copy_end_sse2(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+html_escape_avx2(const uint8_t *data, size_t size)
+{
+	const __m256i amp_apos = _mm256_set1_epi8('\''), bit0 = _mm256_set1_epi8(1);
+	const __m256i lt_gt = _mm256_set1_epi8('>'), bit1 = _mm256_set1_epi8(2);
+	const __m256i quot = _mm256_set1_epi8('"'), slash = _mm256_set1_epi8('/');
+	const __m256i ctrl_max = _mm256_set1_epi8(0x1F);
+	const __m256i tab = _mm256_set1_epi8('\t'), nl = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+	size_t i;
+	unsigned int mask;
+
+	for (i = 0; i + 32 <= size; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+		__m256i special, ctrl, space;
+
+		special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_or_si256(v, bit0), amp_apos),
+				_mm256_cmpeq_epi8(_mm256_or_si256(v, bit1), lt_gt)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, quot), _mm256_cmpeq_epi8(v, slash)));
+
+		ctrl = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl_max), ctrl_max);
+		space = _mm256_or_si256(_mm256_cmpeq_epi8(v, tab),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+
+		mask = _mm256_movemask_epi8(_mm256_or_si256(special, _mm256_andnot_si256(space, ctrl)));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+
+	_mm256_zeroupper();
+	return i + html_escape_sse2(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+output_size_avx2(const uint8_t *data, size_t size)
+{
+	const __m256i lo_set = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)OUTPUT_NIBBLE_LO));
+	const __m256i hi_set = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)OUTPUT_NIBBLE_HI));
+	const __m256i nibble = _mm256_set1_epi8(0x0F), one = _mm256_set1_epi8(1);
+	const __m256i esc_bits = _mm256_set1_epi8(NIBBLE_ESCAPE);
+	const __m256i markup_bits = _mm256_set1_epi8((char)NIBBLE_MARKUP);
+	size_t i = 0, escapes = 0, markup = 0;
+
+	while (i + 32 <= size) {
+		__m256i esc_acc = _mm256_setzero_si256(), markup_acc = _mm256_setzero_si256();
+		int n;
+
+		for (n = 0; n < 255 && i + 32 <= size; n++, i += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+			__m256i kind = _mm256_and_si256(
+				_mm256_shuffle_epi8(lo_set, _mm256_and_si256(v, nibble)),
+				_mm256_shuffle_epi8(hi_set, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+
+			esc_acc = _mm256_add_epi8(esc_acc, _mm256_min_epu8(_mm256_and_si256(kind, esc_bits), one));
+			markup_acc = _mm256_add_epi8(markup_acc, _mm256_min_epu8(_mm256_and_si256(kind, markup_bits), one));
+		}
+
+		esc_acc = _mm256_sad_epu8(esc_acc, _mm256_setzero_si256());
+		markup_acc = _mm256_sad_epu8(markup_acc, _mm256_setzero_si256());
+		esc_acc = _mm256_add_epi64(esc_acc, _mm256_permute4x64_epi64(esc_acc, 0x4E));
+		markup_acc = _mm256_add_epi64(markup_acc, _mm256_permute4x64_epi64(markup_acc, 0x4E));
+		escapes += (size_t)_mm256_extract_epi32(esc_acc, 0) + (size_t)_mm256_extract_epi32(esc_acc, 2);
+		markup += (size_t)_mm256_extract_epi32(markup_acc, 0) + (size_t)_mm256_extract_epi32(markup_acc, 2);
+	}
+
+	_mm256_zeroupper();
+	return i + escapes * ESCAPE_ALLOWANCE + markup * MARKUP_ALLOWANCE +
+		output_size_scalar(data + i, size - i);
+}
+
+static const struct sd_scan_kernels scan_avx2 = {
+	SD_CPU_AVX2, "avx2", copy_end_avx2, html_escape_avx2, output_size_avx2
+};
+
+#endif
+
+/************
+ * DISPATCH *
+ ************/
+
+const struct sd_scan_kernels *sd_scan = &scan_scalar;
+
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+/* cpu_level • the highest level this CPU supports */
+static enum sd_cpu_level
+cpu_level(void)
+{
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return SD_CPU_AVX2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return SD_CPU_SSE42;
+	if (__builtin_cpu_supports("sse2"))
+		return SD_CPU_SSE2;
+#endif
+	return SD_CPU_SCALAR;
+}
+
+static void
+scan_select(void)
+{
+	enum sd_cpu_level level = cpu_level();
+	const char *forced = getenv("SNUDOWN_CPU");
+
+	/* the override can only lower the level */
+	if (forced) {
+		if (strcmp(forced, "scalar") == 0 && level > SD_CPU_SCALAR)
+			level = SD_CPU_SCALAR;
+		else if (strcmp(forced, "sse2") == 0 && level > SD_CPU_SSE2)
+			level = SD_CPU_SSE2;
+		else if (strcmp(forced, "sse4.2") == 0 && level > SD_CPU_SSE42)
+			level = SD_CPU_SSE42;
+	}
+
+	switch (level) {
+#ifdef SCAN_X86
+	case SD_CPU_AVX2: sd_scan = &scan_avx2; break;
+	case SD_CPU_SSE42: sd_scan = &scan_sse42; break;
+	case SD_CPU_SSE2: sd_scan = &scan_sse2; break;
+#endif
+	default: sd_scan = &scan_scalar; break;
+	}
+}
+
+void
+sd_scan_init(void)
+{
+	pthread_once(&scan_once, scan_select);
+}
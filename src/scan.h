@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2015, reddit inc.
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef UPSKIRT_SCAN_H
+#define UPSKIRT_SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Byte-scanning kernels for the hot loops, with one implementation per
+ * instruction set. sd_scan_init() picks the best one the CPU supports;
+ * until then, and on other architectures, the scalar kernels are used.
+ * Setting SNUDOWN_CPU to scalar, sse2, sse4.2 or avx2 caps the level. */
+enum sd_cpu_level {
+	SD_CPU_SCALAR = 0,
+	SD_CPU_SSE2,
+	SD_CPU_SSE42,
+	SD_CPU_AVX2
+};
+
+struct sd_scan_kernels {
+	enum sd_cpu_level level;
+	const char *name;
+
+	/* offset of the first '\n', '\r' or '\t', the bytes the first pass
+	 * rewrites, or size */
+	size_t (*copy_end)(const uint8_t *data, size_t size);
+
+	/* offset of the first byte HTML escaping rewrites or drops, or size */
+	size_t (*html_escape)(const uint8_t *data, size_t size);
+
+	/* estimated rendered size of data: its length, plus an allowance for
+	 * every byte that escaping or markup commonly expands */
+	size_t (*output_size)(const uint8_t *data, size_t size);
+};
+
+extern const struct sd_scan_kernels *sd_scan;
+
+extern void
+sd_scan_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
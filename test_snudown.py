@@ -7,6 +7,11 @@ import sys
 import snudown
 import unittest
 import itertools
+import os
+import json
+import subprocess
+import tempfile
+import time
 try:
     from StringIO import StringIO  # For Python 2
 except ImportError:
@@ -151,6 +156,34 @@ cases = {
     '/U/nope':
         '<p>/U/nope</p>\n',
 
+    '/u/a-b_c/d and r/t:when+foo':
+        '<p><a href="/u/a-b_c/d">/u/a-b_c/d</a> and <a href="/r/t:when+foo">r/t:when+foo</a></p>\n',
+
+    'http://example.com/a<b':
+        '<p><a href="http://example.com/a">http://example.com/a</a>&lt;b</p>\n',
+
+    'see www.example.com/x_(y)) and user@example.com.':
+        '<p>see <a href="http://www.example.com/x_(y)">www.example.com/x_(y)</a>) and <a href="mailto:user@example.com">user@example.com</a>.</p>\n',
+
+    'note: w/o the wiki, see www.reddit.com  \nor /r/all':
+        '<p>note: w/o the wiki, see <a href="http://www.reddit.com">www.reddit.com</a><br/>\nor <a href="/r/all">/r/all</a></p>\n',
+
+    '> * a\n>\n>   b\n> * c\n>\n> >! d\n>\n> e':
+        '<blockquote>\n<ul>\n<li><p>a</p>\n\n<p>b</p></li>\n<li><p>c</p></li>\n</ul>\n\n<blockquote class="md-spoiler-text">\n<p>d</p>\n</blockquote>\n\n<p>e</p>\n</blockquote>\n',
+
+    'a | b\r\n--|--\r\n1 | 2\r\n\r\npara\rline\r\n   ---\r\n\t~~~\r\nx\r\n```\r\n> q':
+        '<table><thead>\n<tr>\n<th>a</th>\n<th>b</th>\n</tr>\n</thead><tbody>\n<tr>\n<td>1</td>\n<td>2</td>\n</tr>\n</tbody></table>\n\n'
+        '<p>para\nline</p>\n\n<hr/>\n\n<pre><code>~~~\n</code></pre>\n\n<p>x\n```</p>\n\n<blockquote>\n<p>q</p>\n</blockquote>\n',
+
+    'a line long enough to span a vector\tthen\ta tab\r\n\r\n\tcode\tblock\r\n\r\n|\tx\t|y\r\n|-|-\r\n|1\t|\t2\r':
+        '<p>a line long enough to span a vector then    a tab</p>\n\n<pre><code>code    block\n</code></pre>\n\n'
+        '<table><thead>\n<tr>\n<th>x</th>\n<th>y</th>\n</tr>\n</thead><tbody>\n<tr>\n<td>1</td>\n<td>2</td>\n</tr>\n</tbody></table>\n',
+
+    '> a | b | c\n> :-|:-:|-:\n> *1* | 2\n> x|y|z|w\n> no pipe':
+        '<blockquote>\n<table><thead>\n<tr>\n<th align="left">a</th>\n<th align="center">b</th>\n<th align="right">c</th>\n</tr>\n</thead><tbody>\n'
+        '<tr>\n<td align="left"><em>1</em></td>\n<td align="center">2</td>\n<td align="right"></td>\n</tr>\n'
+        '<tr>\n<td align="left">x</td>\n<td align="center">y</td>\n<td align="right">z</td>\n</tr>\n</tbody></table>\n\n<p>no pipe</p>\n</blockquote>\n',
+
     '/r/test/m/test test':
         '<p><a href="/r/test/m/test">/r/test/m/test</a> test</p>\n',
 
@@ -432,6 +465,18 @@ cases = {
         '<pre><code>hello, world!\n</code></pre>\n',
     '```javascript\nimport leftpad from "left-pad";\n```':
         '<pre><code class="md-code-language-javascript">import leftpad from &quot;left-pad&quot;;\n</code></pre>\n',
+
+    # Redefining a titled reference without a title
+    '[a]: /b "t"\n\n[a]: /c\n\n[a]':
+        '<p><a href="/c">a</a></p>\n',
+
+    # Brackets and delimiters looked up after an unclosed one
+    '[x [y](/z) \\\\[e](/f) \\[g](/h) *a [b* ~~c `d ~~e`':
+        '<p><a href="/f">x <a href="/z">y</a> \\[e</a> [g](/h) <em>a [b</em> ~~c <code>d ~~e</code></p>\n',
+    'a >!b [c >!d](/e) !< >!f':
+        '<p>a <span class="md-spoiler-text">b <a href="/e">c &gt;!d</a> </span> &gt;!f</p>\n',
+    ''.join('[r%d]: /%d\n' % (i, i) for i in range(40)) + '\n[r0], [R17], [r39] and [r40]':
+        '<p><a href="/0">r0</a>, <a href="/17">R17</a>, <a href="/39">r39</a> and [r40]</p>\n',
 }
 
 cases.update(unicode_cases)
@@ -460,6 +505,12 @@ for i in test_range(65550):
 cases[ent_test_key] = '<p>%s</p>\n' % ent_test_val
 
 wiki_cases = {
+    '<td colspan=x"2" rowspan = "3" scope=\'a"b\'>':
+        '<p><td colspan="2" scope="a&quot;b"></p>\n',
+
+    '<th ROWSPAN="1"cellpadding="2"="3">':
+        '<p><th ROWSPAN="1" cellpadding="2"></p>\n',
+
     '<table scope="foo"bar>':
         '<p><table scope="foo"></p>\n',
 
@@ -524,6 +575,55 @@ wiki_cases = {
         '<p><table scope="foo"></p>\n',
 }
 
+extract_cases = {
+    'hi /r/foo and u/bar':
+        {'links': [], 'images': [], 'subreddits': [(3, '/r/foo')],
+         'usernames': [(14, '/u/bar')]},
+
+    'see http://x.com/a, www.reddit.com and [t](/lol "title")':
+        {'links': [(4, 'http://x.com/a'), (20, 'http://www.reddit.com'), (43, '/lol')],
+         'images': [], 'subreddits': [], 'usernames': []},
+
+    '![img](http://i.imgur.com/a.png) `/r/nope` [ref]\n\n[ref]: /r/yes':
+        {'links': [], 'images': [(7, 'http://i.imgur.com/a.png')],
+         'subreddits': [(57, '/r/yes')], 'usernames': []},
+
+    '| a | b |\n|---|---|\n| /r/pics | foo@example.com |\n':
+        {'links': [(32, 'foo@example.com')], 'images': [],
+         'subreddits': [(22, '/r/pics')], 'usernames': []},
+
+    # offsets point at the target the parser found, not an earlier copy
+    '`/r/foo` /r/foo':
+        {'links': [], 'images': [], 'subreddits': [(9, '/r/foo')], 'usernames': []},
+
+    '\tx /r/foo\n/r/foo':
+        {'links': [], 'images': [], 'subreddits': [(10, '/r/foo')], 'usernames': []},
+
+    '[a [b](/c) d](/e)':
+        {'links': [(7, '/c'), (14, '/e')], 'images': [], 'subreddits': [], 'usernames': []},
+
+    '> a\r\n>\tb [c](/d)\r\n>\r\n> * u/bar\r\n>\r\n>   www.x.com':
+        {'links': [(13, '/d'), (39, 'http://www.x.com')], 'images': [],
+         'subreddits': [], 'usernames': [(25, '/u/bar')]},
+}
+
+ast_cases = {
+    '# *hi*':
+        [(snudown.AST_DOCUMENT, 0, -1, 0, None, None, None),
+         (snudown.AST_HEADER, 0, 0, 1, None, None, None),
+         (snudown.AST_EMPHASIS, 0, 1, 0, None, None, None),
+         (snudown.AST_TEXT, 0, 2, 0, 'hi', None, None)],
+
+    '> [a](http://x.com "t") &amp;':
+        [(snudown.AST_DOCUMENT, 0, -1, 0, None, None, None),
+         (snudown.AST_BLOCKQUOTE, 0, 0, 0, None, None, None),
+         (snudown.AST_PARAGRAPH, 0, 1, 0, None, None, None),
+         (snudown.AST_LINK, 0, 2, 0, None, 'http://x.com', 't'),
+         (snudown.AST_TEXT, 0, 3, 0, 'a', None, None),
+         (snudown.AST_TEXT, 0, 2, 0, ' ', None, None),
+         (snudown.AST_ENTITY, 0, 2, 0, '&amp;', None, None)],
+}
+
 class SnudownTestCase(unittest.TestCase):
     def __init__(self, renderer=snudown.RENDERER_USERTEXT):
         self.renderer = renderer
@@ -544,6 +644,288 @@ class SnudownTestCase(unittest.TestCase):
                 self.fail(test_io.getvalue())
 
 
+class SnudownExtractTestCase(unittest.TestCase):
+    def runTest(self):
+        output = snudown.extract(self.input)
+        self.assertEqual(output, self.expected_output,
+                         "extract failed for input: %r" % self.input)
+
+
+class SnudownAstTestCase(unittest.TestCase):
+    def runTest(self):
+        output = snudown.ast(self.input)
+        self.assertEqual(output, self.expected_output,
+                         "ast failed for input: %r" % self.input)
+
+
+class SnudownSerializeTestCase(unittest.TestCase):
+    def __init__(self, renderer=snudown.RENDERER_USERTEXT):
+        self.renderer = renderer
+        unittest.TestCase.__init__(self)
+
+    def runTest(self):
+        blob = snudown.serialize(self.input, renderer=self.renderer)
+        for nofollow, target in ((False, None), (True, '_top')):
+            expected = snudown.markdown(self.input, renderer=self.renderer,
+                                        nofollow=nofollow, target=target)
+            output = snudown.expand(blob, nofollow=nofollow, target=target)
+            self.assertEqual(output, expected,
+                             "expand failed for input: %r" % self.input)
+
+
+# Successive versions of a document, each rendered incrementally from the last
+edit_cases = (
+    ('first\n\nsecond\n\nthird', 'first\n\nsecond edited\n\nthird',
+     'first\n\nsecond edited\n\nthird\n\nfourth', 'second edited\n\nthird\n\nfourth'),
+    ('para\n\nnext\n\nlast', 'para\n===\nnext\n\nlast', 'para\nnext\n\nlast'),
+    ('```\ncode\n```\n\ntext', '```\ncode\n``\n\ntext', '```\ncode\n```\n\ntext'),
+    ('* one\n* two\n\nafter', '* one\n* two\n\n    after', '* one\n\n* two\n\nafter'),
+    ('>! secret\n\nplain', '>! secret\n\nplain !<', '>! secret\n\nplain'),
+    ('[a]\n\n[b]\n\n[a]: http://a.com', '[a]\n\n[b]\n\n[a]: http://a.com\n[b]: http://b.com',
+     '[a]\n\n[b]\n\n[a]: http://c.com "title"\n[b]: http://b.com'),
+    ('|a|b|\n|-|-|\n|1|2|\n\nx', '|a|b|\n|-|-|\n|1|2|\nx', '|a|b|\n|-|-|\n|1|2|\n\nx'),
+    ('\n\nhello\n\n---\n', 'hello\n\n---\n', '\r\nhello\r\n\r\n---\r\n', ''),
+    ('a\tb\r\n\r\nc\td\r\n\r\ne', 'a\tb\r\n\r\nc\t\td\r\n\r\ne', 'a\tb\r\n\r\nc\td\re\r'),
+    ('[x]\n\n[x]: /a\n\n"t"', '[x]\n\n[x]: /a\n"t"', '[x]\n\n[x]:\n/a\n"t"'),
+    ('\ufeffa\n\nb', '\ufeffa\n\nbc', 'a\n\nbc'),
+    ('|', '|', '|\n|'),
+    tuple('[r]: /r\n\n' + 'p [r]\n\n' * 40 + middle + '\n\n' + 'q [s]\n\n' * 40
+          for middle in ('mid', 'mid edited', '[s]: /s', 'mid\tedited', '')),
+)
+
+class SnudownDocumentTestCase(unittest.TestCase):
+    def __init__(self, renderer=snudown.RENDERER_USERTEXT):
+        self.renderer = renderer
+        unittest.TestCase.__init__(self)
+
+    def runTest(self):
+        document = snudown.Document(renderer=self.renderer, nofollow=True, target='_top')
+        for version in self.versions:
+            expected = snudown.markdown(version, renderer=self.renderer,
+                                        nofollow=True, target='_top')
+            self.assertEqual(document.render(version), expected,
+                             "incremental render failed for input: %r" % version)
+
+class SnudownParallelTestCase(unittest.TestCase):
+    def __init__(self, renderer=snudown.RENDERER_USERTEXT):
+        self.renderer = renderer
+        unittest.TestCase.__init__(self)
+
+    def runTest(self):
+        inputs = [input for input in list(cases) + list(wiki_cases)
+                  if isinstance(input, str) and len(input) < 2000]
+        document = '\n\n'.join(inputs * 64)
+        for enable_toc in (False, True):
+            expected = snudown.markdown(document, renderer=self.renderer,
+                                        enable_toc=enable_toc, toc_id_prefix='p-')
+            for threads in (2, 4):
+                output = snudown.markdown(document, renderer=self.renderer,
+                                          enable_toc=enable_toc, toc_id_prefix='p-',
+                                          threads=threads)
+                self.assertEqual(output, expected,
+                                 "parallel render with %d threads failed" % threads)
+
+class SnudownCacheTestCase(unittest.TestCase):
+    def runTest(self):
+        inputs = [input for input in cases if len(input) < 10000]
+        expected = dict(((input, toc), snudown.markdown(input, enable_toc=toc, target='_top'))
+                        for input in inputs for toc in (False, True))
+
+        fd, path = tempfile.mkstemp()
+        os.close(fd)
+        os.unlink(path)
+        try:
+            snudown.enable_cache(path, size=1024 * 1024)
+            # the second round is served from the cache
+            for round in range(2):
+                for (input, toc), output in expected.items():
+                    self.assertEqual(snudown.markdown(input, enable_toc=toc, target='_top'), output,
+                                     "cached render failed for input: %r" % input)
+                self.assertEqual(snudown.cache_stats(), (round * len(expected), len(expected)))
+
+            # the entries live in the file, so reopening it keeps them
+            snudown.enable_cache(path, size=1024 * 1024)
+            for (input, toc), output in expected.items():
+                snudown.markdown(input, enable_toc=toc, target='_top')
+            self.assertEqual(snudown.cache_stats(), (len(expected), 0))
+        finally:
+            snudown.disable_cache()
+            os.unlink(path)
+
+def fill(unit, size):
+    return (unit * (size // len(unit) + 1))[:size]
+
+def references(size):
+    return ''.join('[r%d]: http://example.com/%d\n' % (i, i) for i in range(size // 32))
+
+# Shapes of input that rendered in quadratic time at some point, as
+# functions from a size in bytes to a document of that size
+scaling_cases = {
+    'brackets': lambda size: fill('[', size),
+    'brackets closed at the end': lambda size: fill('[', size - 1) + ']',
+    'unclosed links': lambda size: fill('[a ', size),
+    'emphasis runs': lambda size: fill('*_', size),
+    'nested quotes': lambda size: fill('>', size),
+    'quoted lines': lambda size: fill('> > > > > > > > x\n', size),
+    'unclosed divs': lambda size: fill('<div>', size),
+    'unclosed div lines': lambda size: fill('<div>\n', size),
+    'spoiler openers': lambda size: fill('>!a ', size),
+    'spoiler lines': lambda size: fill('>! a\n', size),
+    'reference definitions': references,
+    'nested lists': lambda size: fill('* a\n  * b\n    * c\n      * d\n', size),
+    'emphasis openers': lambda size: fill('*a ', size),
+    'underscore openers': lambda size: fill('_a ', size),
+    'strikethrough openers': lambda size: fill('~~a ', size),
+    'emphasis before list markers': lambda size: fill('*(  * ', size),
+    'emphasis over code spans': lambda size: fill('**```]', size),
+    'emphasis over links and code spans': lambda size: fill('`][**a', size),
+    'tag openers': lambda size: fill('<a', size),
+    'superscript openers': lambda size: fill('^(', size),
+    'spoiler paragraphs': lambda size: fill('>!a\n\n', size),
+    'inline links without a closing paren': lambda size: fill(' ](a[', size),
+    'inline links with unclosed titles': lambda size: fill(' ](a "b [', size),
+    'emphasis after code spans': lambda size: fill('`* ***', size),
+    'email addresses with several ats': lambda size: fill('@a', size),
+    'links after escaped backslashes': lambda size: fill('\\\\[', size),
+    'spoiler paragraphs over links': lambda size: fill('>![<div>a![![\n\n', size),
+    'spoiler paragraphs over code spans': lambda size: fill('>!```@<@```\n\n\n\n', size),
+    'spoiler lines before a closing bracket': lambda size: fill('>![^(\n', size - 1) + ']',
+    'inline links with escaped parens': lambda size: fill('[](a\\)', size),
+    'inline links with unclosed titles and escaped parens': lambda size: fill('[](a "b\\)', size),
+    'autolinks with escaped closers': lambda size: fill('<http://\\>', size),
+}
+
+class SnudownScalingTestCase(unittest.TestCase):
+    sizes = (1000, 10000, 100000, 1000000)
+
+    # how much slower per byte the largest document may render than the
+    # smallest; a quadratic shape is about a thousand times slower
+    slack = 16
+
+    # every size is timed as the best of three runs, each rendering the
+    # document for at least this many seconds
+    min_time = 0.01
+
+    def runTest(self):
+        timer = getattr(time, 'perf_counter', time.time)
+        rates = []
+        for size in self.sizes:
+            document = self.shape(size)
+            best = None
+            for _ in range(3):
+                loops = 0
+                start = timer()
+                while True:
+                    snudown.markdown(document, renderer=snudown.RENDERER_WIKI)
+                    loops += 1
+                    elapsed = timer() - start
+                    if elapsed >= self.min_time:
+                        break
+                if best is None or elapsed / loops < best:
+                    best = elapsed / loops
+            rates.append(best / size)
+
+        self.assertLess(max(rates), min(rates) * self.slack,
+                        "%s render in %s seconds per MB at sizes %r" %
+                        (self.name, ', '.join('%.3f' % (r * 1e6) for r in rates), self.sizes))
+
+# Renders the JSON list of documents on stdin with both renderers
+cpu_level_script = '''
+import json, sys, snudown
+docs = json.load(sys.stdin)
+json.dump([snudown.CPU_LEVEL] + [snudown.markdown(doc, renderer=renderer)
+    for renderer in (snudown.RENDERER_USERTEXT, snudown.RENDERER_WIKI) for doc in docs], sys.stdout)
+'''
+
+class SnudownCpuLevelTestCase(unittest.TestCase):
+    def runTest(self):
+        inputs = [input for input in list(cases) + list(wiki_cases) if isinstance(input, str)]
+        expected = [snudown.markdown(input, renderer=renderer)
+                    for renderer in (snudown.RENDERER_USERTEXT, snudown.RENDERER_WIKI)
+                    for input in inputs]
+
+        env = dict(os.environ)
+        env['PYTHONPATH'] = os.path.dirname(os.path.abspath(snudown.__file__))
+        for level in ('scalar', 'sse2', 'sse4.2', 'avx2'):
+            env['SNUDOWN_CPU'] = level
+            child = subprocess.Popen([sys.executable, '-c', cpu_level_script], env=env,
+                                     stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+            output = json.loads(child.communicate(json.dumps(inputs).encode('utf-8'))[0].decode('utf-8'))
+            self.assertEqual(output[1:], expected,
+                             "render with SNUDOWN_CPU=%s (%s) differs" % (level, output[0]))
+
+output_size_script = '''
+import json, sys, snudown
+docs = [doc.encode('latin-1') for doc in json.load(sys.stdin)]
+json.dump([snudown.CPU_LEVEL] + [snudown.output_size(doc) for doc in docs], sys.stdout)
+'''
+
+class SnudownOutputSizeTestCase(unittest.TestCase):
+    def runTest(self):
+        # every byte value, at lengths around each kernel's block size
+        data = bytes(bytearray(range(256))) * 5 + b'|' * 300 + b'&<>\n' * 100
+        inputs = [data[i:i + size] for i in (0, 7, 60, 255)
+                  for size in (0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 255, 256, 1000)]
+        inputs += [input.encode('utf-8') for input in list(cases) + list(wiki_cases)
+                   if isinstance(input, str)]
+
+        env = dict(os.environ)
+        env['PYTHONPATH'] = os.path.dirname(os.path.abspath(snudown.__file__))
+        expected = None
+        for level in ('scalar', 'sse2', 'sse4.2', 'avx2'):
+            env['SNUDOWN_CPU'] = level
+            child = subprocess.Popen([sys.executable, '-c', output_size_script], env=env,
+                                     stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+            output = json.loads(child.communicate(
+                json.dumps([input.decode('latin-1') for input in inputs]).encode('utf-8'))[0].decode('utf-8'))
+            if expected is None:
+                expected = output[1:]
+            self.assertEqual(output[1:], expected,
+                             "output_size with SNUDOWN_CPU=%s (%s) differs" % (level, output[0]))
+
+cli_path = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'cli', 'build', 'snudown')
+
+class SnudownCliTestCase(unittest.TestCase):
+    def __init__(self, renderer=snudown.RENDERER_USERTEXT):
+        self.renderer = renderer
+        unittest.TestCase.__init__(self)
+
+    def setUp(self):
+        if not os.path.exists(cli_path):
+            try:
+                subprocess.check_call(['make', '-C', os.path.dirname(os.path.dirname(cli_path)), 'build/snudown'],
+                                      stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            except (OSError, subprocess.CalledProcessError):
+                self.skipTest("the command-line renderer does not build here")
+
+    def run_cli(self, args, data):
+        renderer = 'wiki' if self.renderer == snudown.RENDERER_WIKI else 'usertext'
+        child = subprocess.Popen([cli_path, '-q', '-r', renderer] + args,
+                                 stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        output = child.communicate(data)[0]
+        self.assertEqual(child.returncode, 0)
+        return output
+
+    def runTest(self):
+        inputs = [input for input in list(cases) + list(wiki_cases)
+                  if isinstance(input, str) and '\0' not in input]
+        options = [([], {}),
+                   (['-j', '4', '--nofollow', '--target', '_top'], dict(nofollow=True, target='_top')),
+                   (['--toc', '--toc-id-prefix', 'p_'], dict(enable_toc=True, toc_id_prefix='p_'))]
+
+        for args, kwargs in options:
+            expected = [snudown.markdown(input, renderer=self.renderer, **kwargs) for input in inputs]
+
+            output = self.run_cli(['-f', 'jsonl'] + args,
+                                  ''.join(json.dumps(input) + '\n' for input in inputs).encode('utf-8'))
+            self.assertEqual([json.loads(line) for line in output.decode('utf-8').splitlines()], expected,
+                             "jsonl render with %r differs" % (args,))
+
+            output = self.run_cli(['-f', 'nul'] + args,
+                                  b''.join(input.encode('utf-8') + b'\0' for input in inputs))
+            self.assertEqual(output.decode('utf-8').split('\0')[:-1], expected,
+                             "nul render with %r differs" % (args,))
+
 def test_snudown():
     suite = unittest.TestSuite()
 
@@ -559,6 +941,50 @@ def test_snudown():
         case.expected_output = expected_output
         suite.addTest(case)
 
+    for input, expected_output in extract_cases.items():
+        case = SnudownExtractTestCase()
+        case.input = input
+        case.expected_output = expected_output
+        suite.addTest(case)
+
+    for input in wiki_cases:
+        case = SnudownSerializeTestCase(renderer=snudown.RENDERER_WIKI)
+        case.input = input
+        suite.addTest(case)
+
+    for input in cases:
+        case = SnudownSerializeTestCase()
+        case.input = input
+        suite.addTest(case)
+
+    for versions in edit_cases:
+        for renderer in (snudown.RENDERER_USERTEXT, snudown.RENDERER_WIKI):
+            case = SnudownDocumentTestCase(renderer=renderer)
+            case.versions = versions
+            suite.addTest(case)
+
+    for renderer in (snudown.RENDERER_USERTEXT, snudown.RENDERER_WIKI):
+        suite.addTest(SnudownParallelTestCase(renderer=renderer))
+
+    suite.addTest(SnudownCacheTestCase())
+    suite.addTest(SnudownCpuLevelTestCase())
+    suite.addTest(SnudownOutputSizeTestCase())
+
+    for renderer in (snudown.RENDERER_USERTEXT, snudown.RENDERER_WIKI):
+        suite.addTest(SnudownCliTestCase(renderer=renderer))
+
+    for name, shape in scaling_cases.items():
+        case = SnudownScalingTestCase()
+        case.name = name
+        case.shape = shape
+        suite.addTest(case)
+
+    for input, expected_output in ast_cases.items():
+        case = SnudownAstTestCase()
+        case.input = input
+        case.expected_output = expected_output
+        suite.addTest(case)
+
     return suite
 
 if __name__ == '__main__':